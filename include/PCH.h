@@ -32,6 +32,20 @@ using uint = uint32_t;
 
 #include <magic_enum/magic_enum.hpp>
 
+// Profiling zones compile to nothing unless built with TRACY_SUPPORT
+#ifdef TRACY_ENABLE
+#	include <tracy/Tracy.hpp>
+#else
+#	define ZoneScoped
+#	define ZoneScopedN(name)
+#	define ZoneScopedNC(name, color)
+#	define FrameMark
+#	define TracyPlot(name, value)
+#endif
+
+// Zone colour for time spent blocked on a fence, timer or waitable object
+#define TRACY_WAIT_COLOR 0xC04040
+
 #ifdef NDEBUG
 #	include <spdlog/sinks/basic_file_sink.h>
 #else
@@ -0,0 +1,19 @@
+// Pre- and post-alpha colours are compared through this hash, both sides must use the same one
+uint HashColor(float3 color)
+{
+	uint3 bits = f32tof16(color);
+	uint hash = bits.x | (bits.y << 16);
+	return hash ^ (bits.z * 0x9E3779B1);
+}
+
+// Kept per pixel for the mask pass, which only reads it in tiles that changed
+uint FoldHash(uint hash)
+{
+	return (hash ^ (hash >> 16)) & 0xFFFF;
+}
+
+// An 8x8 tile is reduced to the sum and xor of its pixel hashes, the pixel's place in the tile is mixed in so swapped pixels still differ
+uint MixTilePixel(uint hash, uint index)
+{
+	return (hash ^ (index * 0x9E3779B1)) * 0x85EBCA6B;
+}
@@ -0,0 +1,31 @@
+#include "AlphaTileHash.hlsli"
+
+Texture2D<float4> InputTextureAfterAlpha : register(t0);
+Texture2D<uint2> InputTileSignaturePreAlpha : register(t1);
+
+AppendStructuredBuffer<uint> OutputTiles : register(u0);
+
+groupshared uint tileSum;
+groupshared uint tileXor;
+
+// One group per 8x8 tile, tiles alpha geometry touched are appended for the mask pass
+[numthreads(8, 8, 1)] void main(uint3 DTid
+								: SV_DispatchThreadID, uint3 Gid
+								: SV_GroupID, uint GI
+								: SV_GroupIndex) {
+	if (GI == 0) {
+		tileSum = 0;
+		tileXor = 0;
+	}
+
+	GroupMemoryBarrierWithGroupSync();
+
+	uint mixed = MixTilePixel(HashColor(InputTextureAfterAlpha[DTid.xy].xyz), GI);
+	InterlockedAdd(tileSum, mixed);
+	InterlockedXor(tileXor, mixed);
+
+	GroupMemoryBarrierWithGroupSync();
+
+	if (GI == 0 && any(uint2(tileSum, tileXor) != InputTileSignaturePreAlpha[Gid.xy]))
+		OutputTiles.Append(Gid.x | (Gid.y << 16));
+}
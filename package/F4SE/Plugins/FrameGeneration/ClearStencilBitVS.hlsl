@@ -0,0 +1,7 @@
+// One triangle covering the viewport, no vertex buffer
+float4 main(uint VertexID
+			: SV_VertexID) : SV_Position
+{
+	float2 uv = float2((VertexID << 1) & 2, VertexID & 2);
+	return float4(uv * float2(2.0, -2.0) + float2(-1.0, 1.0), 0.0, 1.0);
+}
@@ -0,0 +1,10 @@
+// Used when the shared motion vectors are packed or in another format, otherwise they are copied
+#include "SharedOutputs.hlsli"
+
+Texture2D<float> InputDepth : register(t0);
+Texture2D<float2> InputMotionVectors : register(t1);
+
+[numthreads(8, 8, 1)] void main(uint3 DTid
+								: SV_DispatchThreadID) {
+	WriteDepthMotionVectors(DTid.xy, InputDepth[DTid.xy], InputMotionVectors[DTid.xy]);
+}
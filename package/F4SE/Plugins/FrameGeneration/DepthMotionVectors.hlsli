@@ -0,0 +1,11 @@
+// Depth and motion vectors share one R32G32_UINT texture when packed, the depth as is and the motion vector as two halves
+uint2 PackDepthMotionVectors(float depth, float2 motionVector)
+{
+	return uint2(asuint(depth), f32tof16(motionVector.x) | (f32tof16(motionVector.y) << 16));
+}
+
+void UnpackDepthMotionVectors(uint2 packed, out float depth, out float2 motionVector)
+{
+	depth = asfloat(packed.x);
+	motionVector = float2(f16tof32(packed.y), f16tof32(packed.y >> 16));
+}
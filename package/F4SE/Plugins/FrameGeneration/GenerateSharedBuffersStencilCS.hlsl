@@ -0,0 +1,33 @@
+#include "SharedOutputs.hlsli"
+
+Texture2D<float> InputDepth : register(t0);
+Texture2D<uint2> InputStencil : register(t1);
+
+#if defined(PACK_DEPTH_MOTION_VECTORS) || defined(CONVERT_MOTION_VECTORS)
+#	define READ_MOTION_VECTORS
+Texture2D<float2> InputMotionVectors : register(t2);
+#endif
+
+// Must match Upscaling::kAlphaStencilBit
+#define ALPHA_STENCIL_BIT 0x80
+
+[numthreads(8, 8, 1)] void main(uint3 DTid
+								: SV_DispatchThreadID) {
+
+	float depth = InputDepth[DTid.xy];
+
+	// Alpha geometry set the bit wherever it passed the depth test
+	bool alpha = InputStencil[DTid.xy].g & ALPHA_STENCIL_BIT;
+
+#ifdef READ_MOTION_VECTORS
+	WriteDepthMotionVectors(DTid.xy, alpha ? min(depth, 0.1) : depth, alpha ? 0.0 : InputMotionVectors[DTid.xy]);
+#else
+	// The output holds the game's motion vectors already, only marked pixels are written
+#	ifndef MASK_DEPTH_ONLY
+	if (alpha)
+		OutputMotionVectors[DTid.xy] = 0.0;
+#	endif
+
+	OutputDepth[DTid.xy] = alpha ? min(depth, 0.1) : depth;
+#endif
+}
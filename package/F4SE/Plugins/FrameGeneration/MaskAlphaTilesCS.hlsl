@@ -0,0 +1,22 @@
+#include "AlphaTileHash.hlsli"
+#include "SharedOutputs.hlsli"
+
+StructuredBuffer<uint> InputTiles : register(t0);
+Texture2D<float4> InputTextureAfterAlpha : register(t1);
+Texture2D<uint> InputHashPreAlpha : register(t2);
+
+// Packed and 16-bit outputs cannot be read back as a typed UAV, so the depth comes from the game again
+Texture2D<float> InputDepth : register(t3);
+
+// Dispatched indirectly with one group per classified tile, the outputs already hold the copied motion vectors and depth
+[numthreads(8, 8, 1)] void main(uint3 Gid
+								: SV_GroupID, uint3 GTid
+								: SV_GroupThreadID) {
+	uint tile = InputTiles[Gid.x];
+	uint2 pixel = uint2(tile & 0xFFFF, tile >> 16) * 8 + GTid.xy;
+
+	if (FoldHash(HashColor(InputTextureAfterAlpha[pixel].xyz)) == InputHashPreAlpha[pixel])
+		return;
+
+	WriteDepthMotionVectors(pixel, min(InputDepth[pixel], 0.1), 0.0);
+}
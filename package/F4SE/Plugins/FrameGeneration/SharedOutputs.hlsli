@@ -0,0 +1,24 @@
+#include "DepthMotionVectors.hlsli"
+
+// The frame generation inputs written on the D3D11 side, one packed texture or separate ones
+// With MASK_DEPTH_ONLY the motion vectors are the game's live render target and are left alone
+#ifdef PACK_DEPTH_MOTION_VECTORS
+RWTexture2D<uint2> OutputDepthMotionVectors : register(u0);
+#elif defined(MASK_DEPTH_ONLY)
+RWTexture2D<float> OutputDepth : register(u1);
+#else
+RWTexture2D<float2> OutputMotionVectors : register(u0);
+RWTexture2D<float> OutputDepth : register(u1);
+#endif
+
+void WriteDepthMotionVectors(uint2 pixel, float depth, float2 motionVector)
+{
+#ifdef PACK_DEPTH_MOTION_VECTORS
+	OutputDepthMotionVectors[pixel] = PackDepthMotionVectors(depth, motionVector);
+#elif defined(MASK_DEPTH_ONLY)
+	OutputDepth[pixel] = depth;
+#else
+	OutputMotionVectors[pixel] = motionVector;
+	OutputDepth[pixel] = depth;
+#endif
+}
@@ -0,0 +1,33 @@
+#include "AlphaTileHash.hlsli"
+
+Texture2D<float4> InputTexture : register(t0);
+RWTexture2D<uint> OutputPixelHash : register(u0);
+RWTexture2D<uint2> OutputTileSignature : register(u1);
+
+groupshared uint tileSum;
+groupshared uint tileXor;
+
+// One group per 8x8 tile, classification compares only the tile signature
+[numthreads(8, 8, 1)] void main(uint3 DTid
+								: SV_DispatchThreadID, uint3 Gid
+								: SV_GroupID, uint GI
+								: SV_GroupIndex) {
+	if (GI == 0) {
+		tileSum = 0;
+		tileXor = 0;
+	}
+
+	GroupMemoryBarrierWithGroupSync();
+
+	uint hash = HashColor(InputTexture[DTid.xy].xyz);
+	OutputPixelHash[DTid.xy] = FoldHash(hash);
+
+	uint mixed = MixTilePixel(hash, GI);
+	InterlockedAdd(tileSum, mixed);
+	InterlockedXor(tileXor, mixed);
+
+	GroupMemoryBarrierWithGroupSync();
+
+	if (GI == 0)
+		OutputTileSignature[Gid.xy] = uint2(tileSum, tileXor);
+}
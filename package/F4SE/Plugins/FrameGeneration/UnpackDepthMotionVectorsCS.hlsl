@@ -0,0 +1,17 @@
+#include "DepthMotionVectors.hlsli"
+
+// Runs on the D3D12 queue, FSR wants depth and motion vectors as separate typed textures
+Texture2D<uint2> InputDepthMotionVectors : register(t0);
+
+RWTexture2D<float> UnpackedDepth : register(u0);
+RWTexture2D<float2> UnpackedMotionVectors : register(u1);
+
+[numthreads(8, 8, 1)] void main(uint3 DTid
+								: SV_DispatchThreadID) {
+	float depth;
+	float2 motionVector;
+	UnpackDepthMotionVectors(InputDepthMotionVectors[DTid.xy], depth, motionVector);
+
+	UnpackedDepth[DTid.xy] = depth;
+	UnpackedMotionVectors[DTid.xy] = motionVector;
+}
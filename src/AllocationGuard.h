@@ -0,0 +1,51 @@
+#pragma once
+
+// Debug builds count CRT heap allocations made on the current thread while a guard is alive and
+// warn when a path that must stay allocation free makes any. Release builds compile it out. It is
+// the only check on Present itself, tools/PresentHelpersAllocationCheck covers just the platform
+// independent helpers Present calls.
+#ifdef _DEBUG
+#	include <crtdbg.h>
+
+class AllocationGuard
+{
+public:
+	explicit AllocationGuard(const char* a_name) :
+		name(a_name)
+	{
+		static bool hookInstalled = [] {
+			previousHook = _CrtSetAllocHook(AllocHook);
+			return true;
+		}();
+
+		count = 0;
+		active = true;
+	}
+
+	~AllocationGuard()
+	{
+		active = false;
+		if (count)
+			logger::warn("[Frame Generation] {} made {} heap allocations", name, count);
+	}
+
+private:
+	static int __cdecl AllocHook(int a_allocType, void* a_userData, size_t a_size, int a_blockType, long a_requestNumber, const unsigned char* a_fileName, int a_lineNumber)
+	{
+		if (active && (a_allocType == _HOOK_ALLOC || a_allocType == _HOOK_REALLOC))
+			count++;
+
+		return previousHook ? previousHook(a_allocType, a_userData, a_size, a_blockType, a_requestNumber, a_fileName, a_lineNumber) : TRUE;
+	}
+
+	const char* name;
+
+	static inline _CRT_ALLOC_HOOK previousHook = nullptr;
+	static inline thread_local bool active = false;
+	static inline thread_local uint32_t count = 0;
+};
+
+#	define ALLOCATION_GUARD(name) AllocationGuard allocationGuard{ name }
+#else
+#	define ALLOCATION_GUARD(name)
+#endif
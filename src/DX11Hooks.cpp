@@ -4,8 +4,10 @@
 #pragma comment(lib, "d3d11.lib")
 
 #include "Upscaling.h"
+#include "DisplayWatcher.h"
 #include "DX12SwapChain.h"
 #include "FidelityFX.h"
+#include "LowLatency.h"
 
 #include "ENB/ENBSeriesAPI.h"
 
@@ -13,9 +15,36 @@ bool enbLoaded = false;
 
 decltype(&D3D11CreateDeviceAndSwapChain) ptrD3D11CreateDeviceAndSwapChain;
 decltype(&IDXGIFactory::CreateSwapChain) ptrCreateSwapChain;
+decltype(&PeekMessageA) ptrPeekMessageA;
+decltype(&PeekMessageW) ptrPeekMessageW;
+
+// The message pump runs at the start of each main loop iteration, just before input and simulation
+static void OnMessagePump()
+{
+	// Only zoned when it does work, the game polls messages many times per frame
+	auto lowLatency = LowLatency::GetSingleton();
+	if (lowLatency->frameStartPending.exchange(false)) {
+		ZoneScoped;
+		lowLatency->SimulationStart();
+	}
+}
+
+BOOL WINAPI hk_PeekMessageA(LPMSG lpMsg, HWND hWnd, UINT wMsgFilterMin, UINT wMsgFilterMax, UINT wRemoveMsg)
+{
+	OnMessagePump();
+	return ptrPeekMessageA(lpMsg, hWnd, wMsgFilterMin, wMsgFilterMax, wRemoveMsg);
+}
+
+BOOL WINAPI hk_PeekMessageW(LPMSG lpMsg, HWND hWnd, UINT wMsgFilterMin, UINT wMsgFilterMax, UINT wRemoveMsg)
+{
+	OnMessagePump();
+	return ptrPeekMessageW(lpMsg, hWnd, wMsgFilterMin, wMsgFilterMax, wRemoveMsg);
+}
 
 HRESULT WINAPI hk_IDXGIFactory_CreateSwapChain(IDXGIFactory2* This, _In_ ID3D11Device* a_device, _In_ DXGI_SWAP_CHAIN_DESC* pDesc, _COM_Outptr_ IDXGISwapChain** ppSwapChain)
 {
+	ZoneScoped;
+
 	IDXGIDevice* dxgiDevice = nullptr;
 	DX::ThrowIfFailed(a_device->QueryInterface(__uuidof(IDXGIDevice), (void**)&dxgiDevice));
 
@@ -53,16 +82,19 @@ HRESULT WINAPI hk_D3D11CreateDeviceAndSwapChain(
 	D3D_FEATURE_LEVEL* pFeatureLevel,
 	ID3D11DeviceContext** ppImmediateContext)
 {
+	ZoneScoped;
+
 	auto upscaling = Upscaling::GetSingleton();
 
-	if (pSwapChainDesc->Windowed) {
-		logger::info("[Frame Generation] Frame Generation enabled, using D3D12 proxy");
+	// Fullscreen is handled by the frame generation swap chain as well
+	if (pSwapChainDesc) {
+		logger::info("[Frame Generation] Frame Generation enabled, using D3D12 proxy ({})", pSwapChainDesc->Windowed ? "windowed" : "fullscreen");
 		
 		auto fidelityFX = FidelityFX::GetSingleton();
 
 		if (fidelityFX->module) {
 			upscaling->d3d12Interop = true;
-			upscaling->refreshRate = Upscaling::GetRefreshRate(pSwapChainDesc->OutputWindow);
+			DisplayWatcher::GetSingleton()->Start(pSwapChainDesc->OutputWindow);
 
 			IDXGIFactory4* dxgiFactory;
 			pAdapter->GetParent(IID_PPV_ARGS(&dxgiFactory));
@@ -147,4 +179,13 @@ void DX11Hooks::Install()
 	uintptr_t moduleBase = (uintptr_t)GetModuleHandle(nullptr);
 
 	(uintptr_t&)ptrD3D11CreateDeviceAndSwapChain = Detours::IATHook(moduleBase, "d3d11.dll", "D3D11CreateDeviceAndSwapChain", (uintptr_t)hk_D3D11CreateDeviceAndSwapChain);
+
+	(uintptr_t&)ptrPeekMessageA = Detours::IATHook(moduleBase, "user32.dll", "PeekMessageA", (uintptr_t)hk_PeekMessageA);
+	(uintptr_t&)ptrPeekMessageW = Detours::IATHook(moduleBase, "user32.dll", "PeekMessageW", (uintptr_t)hk_PeekMessageW);
+
+	auto lowLatency = LowLatency::GetSingleton();
+	lowLatency->frameStartHooked = ptrPeekMessageA || ptrPeekMessageW;
+
+	if (!lowLatency->frameStartHooked)
+		logger::warn("[Frame Generation] Message pump not found, frame start falls back to the end of Present");
 }
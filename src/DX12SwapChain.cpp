@@ -3,7 +3,11 @@
 #include <dx12/ffx_api_dx12.hpp>
 #include <dxgi1_6.h>
 
+#include "AllocationGuard.h"
 #include "FidelityFX.h"
+#include "GPUProfiler.h"
+#include "LowLatency.h"
+#include "Telemetry.h"
 #include "Upscaling.h"
 
 extern bool enbLoaded;
@@ -20,17 +24,30 @@ void DX12SwapChain::CreateD3D12Device(IDXGIAdapter* a_adapter)
 
 	DX::ThrowIfFailed(d3d12Device->CreateCommandQueue(&queueDesc, IID_PPV_ARGS(&commandQueue)));
 
-	for (int i = 0; i < 2; i++) {
+	auto& settings = Upscaling::GetSingleton()->settings;
+
+	if (settings.transferQueue) {
+		queueDesc.Type = settings.transferQueue == 1 ? D3D12_COMMAND_LIST_TYPE_COPY : D3D12_COMMAND_LIST_TYPE_COMPUTE;
+		DX::ThrowIfFailed(d3d12Device->CreateCommandQueue(&queueDesc, IID_PPV_ARGS(&transferQueue)));
+		DX::ThrowIfFailed(d3d12Device->CreateFence(0, D3D12_FENCE_FLAG_NONE, IID_PPV_ARGS(&transferFence)));
+	}
+
+	frameRing.SetDepth(settings.frameRingDepth);
+	frameRing.SetMaxFramesAhead(settings.maxFramesAhead);
+
+	for (uint32_t i = 0; i < frameRing.GetDepth(); i++) {
 		DX::ThrowIfFailed(d3d12Device->CreateCommandAllocator(D3D12_COMMAND_LIST_TYPE_DIRECT, IID_PPV_ARGS(&commandAllocators[i])));
 		DX::ThrowIfFailed(d3d12Device->CreateCommandList(0, D3D12_COMMAND_LIST_TYPE_DIRECT, commandAllocators[i].get(), nullptr, IID_PPV_ARGS(&commandLists[i])));
 		commandLists[i]->Close();
 	}
+
+	LowLatency::GetSingleton()->CreateFence(d3d12Device.get());
 }
 
 void DX12SwapChain::CreateSwapChain(IDXGIFactory5* a_dxgiFactory, DXGI_SWAP_CHAIN_DESC a_swapChainDesc)
 {
 	swapChainDesc = {};
-	swapChainDesc.BufferCount = 2;
+	swapChainDesc.BufferCount = frameRing.GetDepth();
 	swapChainDesc.Width = a_swapChainDesc.BufferDesc.Width;
 	swapChainDesc.Height = a_swapChainDesc.BufferDesc.Height;
 	swapChainDesc.Format = a_swapChainDesc.BufferDesc.Format;
@@ -45,13 +62,22 @@ void DX12SwapChain::CreateSwapChain(IDXGIFactory5* a_dxgiFactory, DXGI_SWAP_CHAI
 		sizeof(allowTearing)
 	));
 
-	swapChainDesc.Flags = allowTearing ? DXGI_SWAP_CHAIN_FLAG_ALLOW_TEARING : 0;
+	swapChainDesc.Flags = DXGI_SWAP_CHAIN_FLAG_FRAME_LATENCY_WAITABLE_OBJECT;
+	if (allowTearing)
+		swapChainDesc.Flags |= DXGI_SWAP_CHAIN_FLAG_ALLOW_TEARING;
+
+	// Exclusive fullscreen requested by the game is created by the frame generation swap chain itself
+	fullscreenDesc = {};
+	fullscreenDesc.RefreshRate = a_swapChainDesc.BufferDesc.RefreshRate;
+	fullscreenDesc.ScanlineOrdering = a_swapChainDesc.BufferDesc.ScanlineOrdering;
+	fullscreenDesc.Scaling = a_swapChainDesc.BufferDesc.Scaling;
+	fullscreenDesc.Windowed = a_swapChainDesc.Windowed;
 
 	ffx::CreateContextDescFrameGenerationSwapChainForHwndDX12 ffxSwapChainDesc{};
 
 	ffxSwapChainDesc.desc = &swapChainDesc;
 	ffxSwapChainDesc.dxgiFactory = a_dxgiFactory;
-	ffxSwapChainDesc.fullscreenDesc = nullptr;
+	ffxSwapChainDesc.fullscreenDesc = &fullscreenDesc;
 	ffxSwapChainDesc.gameQueue = commandQueue.get();
 	ffxSwapChainDesc.hwnd = a_swapChainDesc.OutputWindow;
 	ffxSwapChainDesc.swapchain = &swapChain;
@@ -62,11 +88,21 @@ void DX12SwapChain::CreateSwapChain(IDXGIFactory5* a_dxgiFactory, DXGI_SWAP_CHAI
 		logger::critical("[FidelityFX] Failed to create swap chain context!");
 	}
 
-	DX::ThrowIfFailed(swapChain->GetBuffer(0, IID_PPV_ARGS(&swapChainBuffers[0])));
-	DX::ThrowIfFailed(swapChain->GetBuffer(1, IID_PPV_ARGS(&swapChainBuffers[1])));
+	for (uint32_t i = 0; i < frameRing.GetDepth(); i++) {
+		DX::ThrowIfFailed(swapChain->GetBuffer(i, IID_PPV_ARGS(&swapChainBuffers[i])));
+		stateTracker.Track(swapChainBuffers[i].get(), D3D12_RESOURCE_STATE_PRESENT);
+	}
 
 	frameIndex = swapChain->GetCurrentBackBufferIndex();
 
+	// Waited on before each simulation tick, must be set before the first present
+	uint32_t maxFrameLatency = Upscaling::GetSingleton()->settings.maxFrameLatency;
+	DX::ThrowIfFailed(swapChain->SetMaximumFrameLatency(maxFrameLatency));
+	frameLatencyWaitableObject = swapChain->GetFrameLatencyWaitableObject();
+
+	if (FAILED(swapChain->QueryInterface(IID_PPV_ARGS(swapChainMedia.put()))))
+		logger::warn("[Frame Generation] IDXGISwapChainMedia is not available, the present mode cannot be reported");
+
 	fidelityFX->SetupFrameGeneration();
 
 	swapChainProxy = new DXGISwapChainProxy(swapChain);
@@ -80,6 +116,23 @@ void DX12SwapChain::CreateInterop()
 	DX::ThrowIfFailed(d3d11Device->OpenSharedFence(sharedFenceHandle, IID_PPV_ARGS(&d3d11Fence)));
 	CloseHandle(sharedFenceHandle);
 
+	DX::ThrowIfFailed(d3d12Device->CreateFence(0, D3D12_FENCE_FLAG_SHARED, IID_PPV_ARGS(&completionFence12)));
+	DX::ThrowIfFailed(d3d12Device->CreateSharedHandle(completionFence12.get(), nullptr, GENERIC_ALL, nullptr, &sharedFenceHandle));
+	DX::ThrowIfFailed(d3d11Device->OpenSharedFence(sharedFenceHandle, IID_PPV_ARGS(&completionFence11)));
+	CloseHandle(sharedFenceHandle);
+
+	completionEvent = CreateEvent(nullptr, FALSE, FALSE, nullptr);
+
+	CreateWrappedBuffers();
+
+	if (Upscaling::GetSingleton()->settings.gpuProfiling)
+		GPUProfiler::GetSingleton()->Initialize(d3d11Device.get(), d3d11Context.get(), d3d12Device.get(), commandQueue.get(), transferQueue.get());
+
+	RecordCopyCommandLists();
+}
+
+void DX12SwapChain::CreateWrappedBuffers()
+{
 	D3D11_TEXTURE2D_DESC texDesc11{};
 	texDesc11.Width = swapChainDesc.Width;
 	texDesc11.Height = swapChainDesc.Height;
@@ -93,13 +146,76 @@ void DX12SwapChain::CreateInterop()
 	texDesc11.CPUAccessFlags = 0;
 	texDesc11.MiscFlags = 0;
 
-	if (enbLoaded)
+	// Only buffers matching the new size and format exactly are kept, there is no pooling by capacity. A resize that only changes the window mode allocates nothing
+	auto Matches = [&](WrappedResource* a_buffer) {
+		return a_buffer && a_buffer->desc.Width == texDesc11.Width && a_buffer->desc.Height == texDesc11.Height && a_buffer->desc.Format == texDesc11.Format;
+	};
+
+	// ENB keeps its own references to the buffer it was given, so it renders to a fixed proxy that is copied every frame
+	if (enbLoaded && !Matches(swapChainBufferProxyENB)) {
+		delete swapChainBufferProxyENB;
 		swapChainBufferProxyENB = new WrappedResource(texDesc11, d3d11Device.get(), d3d12Device.get());
-	else
-		swapChainBufferProxy = new Texture2D(texDesc11);
+	}
 
-	swapChainBufferWrapped[0] = new WrappedResource(texDesc11, d3d11Device.get(), d3d12Device.get());
-	swapChainBufferWrapped[1] = new WrappedResource(texDesc11, d3d11Device.get(), d3d12Device.get());
+	for (uint32_t i = 0; i < frameRing.GetDepth(); i++) {
+		if (Matches(swapChainBufferWrapped[i]))
+			continue;
+
+		if (swapChainBufferWrapped[i]) {
+			stateTracker.Untrack(swapChainBufferWrapped[i]->resource.get());
+			delete swapChainBufferWrapped[i];
+		}
+
+		swapChainBufferWrapped[i] = new WrappedResource(texDesc11, d3d11Device.get(), d3d12Device.get());
+		stateTracker.Track(swapChainBufferWrapped[i]->resource.get(), D3D12_RESOURCE_STATE_COMMON);
+	}
+}
+
+void DX12SwapChain::RecordCopyCommandLists()
+{
+	auto gpuProfiler = GPUProfiler::GetSingleton();
+
+	// Only COMMON, COPY_SOURCE and COPY_DEST are used, which every queue type can transition between
+	auto type = transferQueue ? transferQueue->GetDesc().Type : D3D12_COMMAND_LIST_TYPE_DIRECT;
+
+	// The copy into the swap chain is identical every time a slot comes around, record it once and replay it
+	for (uint32_t i = 0; i < frameRing.GetDepth(); i++) {
+		// Re-recorded after a resize into the same allocator and list
+		if (copyCommandLists[i]) {
+			DX::ThrowIfFailed(copyCommandAllocators[i]->Reset());
+			DX::ThrowIfFailed(copyCommandLists[i]->Reset(copyCommandAllocators[i].get(), nullptr));
+		} else {
+			DX::ThrowIfFailed(d3d12Device->CreateCommandAllocator(type, IID_PPV_ARGS(&copyCommandAllocators[i])));
+			DX::ThrowIfFailed(d3d12Device->CreateCommandList(0, type, copyCommandAllocators[i].get(), nullptr, IID_PPV_ARGS(&copyCommandLists[i])));
+		}
+
+		auto commandList = copyCommandLists[i].get();
+		auto fakeSwapChain = swapChainBufferWrapped[i]->resource.get();
+		auto realSwapChain = swapChainBuffers[i].get();
+
+		if (transferQueue)
+			gpuProfiler->BeginTransfer(GPUProfiler::Pass::kCopySwapChain, i, commandList);
+		else
+			gpuProfiler->BeginStatic(GPUProfiler::Pass::kCopySwapChain, i, commandList);
+
+		stateTracker.Transition(fakeSwapChain, D3D12_RESOURCE_STATE_COPY_SOURCE);
+		stateTracker.Transition(realSwapChain, D3D12_RESOURCE_STATE_COPY_DEST);
+		stateTracker.Flush(commandList);
+
+		commandList->CopyResource(realSwapChain, fakeSwapChain);
+
+		// Replayed every frame, so the list has to leave everything as it found it
+		stateTracker.Transition(fakeSwapChain, D3D12_RESOURCE_STATE_COMMON);
+		stateTracker.Transition(realSwapChain, D3D12_RESOURCE_STATE_PRESENT);
+		stateTracker.Flush(commandList);
+
+		if (transferQueue)
+			gpuProfiler->EndTransfer(GPUProfiler::Pass::kCopySwapChain, i, commandList);
+		else
+			gpuProfiler->EndStatic(GPUProfiler::Pass::kCopySwapChain, i, commandList);
+
+		DX::ThrowIfFailed(commandList->Close());
+	}
 }
 
 DXGISwapChainProxy* DX12SwapChain::GetSwapChainProxy()
@@ -119,94 +235,376 @@ void DX12SwapChain::SetD3D11DeviceContext(ID3D11DeviceContext* a_d3d11Context)
 
 HRESULT DX12SwapChain::GetBuffer(void** ppSurface)
 {
+	ID3D11Texture2D* buffer;
 	if (enbLoaded)
-		*ppSurface = swapChainBufferProxyENB->resource11;
+		buffer = swapChainBufferProxyENB->resource11;
 	else
-		*ppSurface = swapChainBufferProxy->resource.get();
+		buffer = swapChainBufferWrapped[frameIndex]->resource11;
+
+	buffer->AddRef();
+	*ppSurface = buffer;
 	return S_OK;
 }
 
 HRESULT DX12SwapChain::Present(UINT SyncInterval, UINT Flags)
 {
-	// Copy proxy to wrapped resource
-	if (enbLoaded)
-		d3d11Context->CopyResource(swapChainBufferWrapped[frameIndex]->resource11, swapChainBufferProxyENB->resource11);
-	else
-		d3d11Context->CopyResource(swapChainBufferWrapped[frameIndex]->resource11, swapChainBufferProxy->resource.get());
+	ZoneScoped;
 
-	// Wait for D3D11 to finish
-	DX::ThrowIfFailed(d3d11Context->Signal(d3d11Fence.get(), fenceValue));
-	DX::ThrowIfFailed(commandQueue->Wait(d3d12Fence.get(), fenceValue));
-	fenceValue++;
+	auto upscaling = Upscaling::GetSingleton();
+	auto telemetry = Telemetry::GetSingleton();
+	auto gpuProfiler = GPUProfiler::GetSingleton();
 
-	// New frame, reset
-	DX::ThrowIfFailed(commandAllocators[frameIndex]->Reset());
-	DX::ThrowIfFailed(commandLists[frameIndex]->Reset(commandAllocators[frameIndex].get(), nullptr));
+	bool useFrameGenerationThisFrame = false;
+
+	if (auto main = RE::Main::GetSingleton())
+		if (auto ui = RE::UI::GetSingleton())
+			useFrameGenerationThisFrame = upscaling->settings.frameGenerationMode && main->gameActive && !main->inMenuMode && !ui->movementToDirectionalCount;
 
-	// Copy shared texture to swap chain buffer
 	{
-		auto fakeSwapChain = swapChainBufferWrapped[frameIndex]->resource.get();
-		auto realSwapChain = swapChainBuffers[frameIndex].get();
-		{
-			std::vector<D3D12_RESOURCE_BARRIER> barriers;
-			barriers.push_back(CD3DX12_RESOURCE_BARRIER::Transition(fakeSwapChain, D3D12_RESOURCE_STATE_COMMON, D3D12_RESOURCE_STATE_COPY_SOURCE));
-			barriers.push_back(CD3DX12_RESOURCE_BARRIER::Transition(realSwapChain, D3D12_RESOURCE_STATE_PRESENT, D3D12_RESOURCE_STATE_COPY_DEST));
-			commandLists[frameIndex]->ResourceBarrier(static_cast<UINT>(barriers.size()), barriers.data());
+		ALLOCATION_GUARD("DX12SwapChain::Present");
+
+		// Copy proxy to wrapped resource, without ENB the game rendered straight into it
+		if (enbLoaded) {
+			gpuProfiler->Begin(GPUProfiler::Pass::kCopyProxy);
+			d3d11Context->CopyResource(swapChainBufferWrapped[frameIndex]->resource11, swapChainBufferProxyENB->resource11);
+			gpuProfiler->End(GPUProfiler::Pass::kCopyProxy);
 		}
 
-		commandLists[frameIndex]->CopyResource(realSwapChain, fakeSwapChain);
+		// Anything a skipped pass left discarded is cleared on the D3D11 side before the fence
+		upscaling->ClearSkippedInputs(useFrameGenerationThisFrame);
+
+		gpuProfiler->EndFrame11();
 
+		// Wait for D3D11 to finish
 		{
-			std::vector<D3D12_RESOURCE_BARRIER> barriers;
-			barriers.push_back(CD3DX12_RESOURCE_BARRIER::Transition(fakeSwapChain, D3D12_RESOURCE_STATE_COPY_SOURCE, D3D12_RESOURCE_STATE_COMMON));
-			barriers.push_back(CD3DX12_RESOURCE_BARRIER::Transition(realSwapChain, D3D12_RESOURCE_STATE_COPY_DEST, D3D12_RESOURCE_STATE_PRESENT));
-			commandLists[frameIndex]->ResourceBarrier(static_cast<UINT>(barriers.size()), barriers.data());
+			ZoneScopedNC("Shared fence", TRACY_WAIT_COLOR);
+			telemetry->Mark(Telemetry::Event::kFenceSignal);
+			DX::ThrowIfFailed(d3d11Context->Signal(d3d11Fence.get(), fenceValue));
+			telemetry->Mark(Telemetry::Event::kFenceWait);
+			DX::ThrowIfFailed(commandQueue->Wait(d3d12Fence.get(), fenceValue));
+			if (transferQueue)
+				DX::ThrowIfFailed(transferQueue->Wait(d3d12Fence.get(), fenceValue));
+			fenceValue++;
 		}
-	}
 
-	auto upscaling = Upscaling::GetSingleton();
+		// The allocator and the pre-recorded copy are reused, only blocks when the GPU is still executing this slot's previous frame
+		{
+			ZoneScopedNC("Slot reuse wait", TRACY_WAIT_COLOR);
+			telemetry->Mark(Telemetry::Event::kSlotReuseWait);
+			slotReuseWaits.Add(WaitForCompletion(frameRing.GetReuseValue(frameIndex)));
+			telemetry->Mark(Telemetry::Event::kSlotReuseWaitReturn);
+		}
 
-	bool useFrameGenerationThisFrame = false;
-	
-	if (auto main = RE::Main::GetSingleton())
-		if (auto ui = RE::UI::GetSingleton())
-			useFrameGenerationThisFrame = upscaling->settings.frameGenerationMode && main->gameActive && !main->inMenuMode && !ui->movementToDirectionalCount;
+		// New frame, reset, only FSR work is recorded per frame
+		DX::ThrowIfFailed(commandAllocators[frameIndex]->Reset());
+		DX::ThrowIfFailed(commandLists[frameIndex]->Reset(commandAllocators[frameIndex].get(), nullptr));
+
+		if (transferQueue)
+			gpuProfiler->UseTransfer(GPUProfiler::Pass::kCopySwapChain, frameIndex);
+		else
+			gpuProfiler->UseStatic(GPUProfiler::Pass::kCopySwapChain, frameIndex);
+
+		telemetry->SetFrameGeneration(useFrameGenerationThisFrame);
+
+		auto fidelityFX = FidelityFX::GetSingleton();
+		interpolationFrames[frameIndex] = fidelityFX->frameID;
+		interpolationPending[frameIndex] = useFrameGenerationThisFrame;
+
+		fidelityFX->Present(useFrameGenerationThisFrame);
 
-	FidelityFX::GetSingleton()->Present(useFrameGenerationThisFrame);
+		gpuProfiler->ResolveFrame12(commandLists[frameIndex].get());
 
-	DX::ThrowIfFailed(commandLists[frameIndex]->Close());
+		DX::ThrowIfFailed(commandLists[frameIndex]->Close());
 
-	ID3D12CommandList* commandListsToExecute[] = { commandLists[frameIndex].get() };
-	commandQueue->ExecuteCommandLists(1, commandListsToExecute);
+		if (transferQueue) {
+			// The copy runs alongside the FSR work, the game queue only waits for it before presenting
+			ID3D12CommandList* transferLists[] = { copyCommandLists[frameIndex].get() };
+			transferQueue->ExecuteCommandLists(ARRAYSIZE(transferLists), transferLists);
+			DX::ThrowIfFailed(transferQueue->Signal(transferFence.get(), ++transferFenceValue));
+
+			ID3D12CommandList* commandListsToExecute[] = { commandLists[frameIndex].get() };
+			commandQueue->ExecuteCommandLists(ARRAYSIZE(commandListsToExecute), commandListsToExecute);
+			DX::ThrowIfFailed(commandQueue->Wait(transferFence.get(), transferFenceValue));
+		} else {
+			// Copy shared texture to swap chain buffer, then the FSR work
+			ID3D12CommandList* commandListsToExecute[] = { copyCommandLists[frameIndex].get(), commandLists[frameIndex].get() };
+			commandQueue->ExecuteCommandLists(ARRAYSIZE(commandListsToExecute), commandListsToExecute);
+		}
+	}
+
+	gpuProfiler->EndFrame12();
+
+	auto lowLatency = LowLatency::GetSingleton();
+	lowLatency->Present(commandQueue.get());
 
 	// Fix FPS cap being e.g. 55 instead of 60
 	if (!upscaling->highFPSPhysicsFixLoaded && SyncInterval > 0)
 		SyncInterval = 1;
 
 	// Present the frame
-	DX::ThrowIfFailed(swapChain->Present(SyncInterval, Flags));
+	{
+		ZoneScopedN("IDXGISwapChain::Present");
+		telemetry->Mark(Telemetry::Event::kPresent);
+		DX::ThrowIfFailed(swapChain->Present(SyncInterval, Flags));
+		telemetry->Mark(Telemetry::Event::kPresentReturn);
+	}
+
+	// FSR has consumed this slot's shared buffers once the queue passes its present
+	DX::ThrowIfFailed(commandQueue->Signal(completionFence12.get(), frameRing.Retire(frameIndex)));
+
+	FrameMark;
+
+	if (frameRing.GetTimeline() % 120 == 0)
+		CheckPresentMode();
 
-	// Wait for previous frame to have finished
-	auto frameLatencyWaitableObject = swapChain->GetFrameLatencyWaitableObject();
-	WaitForSingleObjectEx(frameLatencyWaitableObject, INFINITE, TRUE);
+	// Let the CPU run at most iMaxFramesAhead frames ahead of the GPU, low latency mode waits before the next simulation tick instead
+	if (!upscaling->settings.lowLatencyMode) {
+		ZoneScopedNC("Frames ahead wait", TRACY_WAIT_COLOR);
+		telemetry->Mark(Telemetry::Event::kFramesAheadWait);
+		framesAheadWaits.Add(WaitForCompletion(frameRing.GetFramesAheadValue()));
+		telemetry->Mark(Telemetry::Event::kFramesAheadWaitReturn);
+	}
+
+	if (slotReuseWaits.frames >= 1000) {
+		double ticksToMs = 1000.0 / double(upscaling->clock.Frequency());
+		logger::info("[Frame Generation] Frames ahead wait {:.3f} ms avg, {:.3f} ms max, {} of {} frames; slot reuse wait {:.3f} ms avg, {:.3f} ms max, {} of {} frames; interpolation wait {:.3f} ms avg, {:.3f} ms max, {} of {} frames",
+			double(framesAheadWaits.totalTicks) / double(std::max(framesAheadWaits.frames, 1ull)) * ticksToMs, double(framesAheadWaits.maxTicks) * ticksToMs, framesAheadWaits.waits, framesAheadWaits.frames,
+			double(slotReuseWaits.totalTicks) / double(slotReuseWaits.frames) * ticksToMs, double(slotReuseWaits.maxTicks) * ticksToMs, slotReuseWaits.waits, slotReuseWaits.frames,
+			double(interpolationWaits.totalTicks) / double(std::max(interpolationWaits.frames, 1ull)) * ticksToMs, double(interpolationWaits.maxTicks) * ticksToMs, interpolationWaits.waits, interpolationWaits.frames);
+		framesAheadWaits = {};
+		slotReuseWaits = {};
+		interpolationWaits = {};
+	}
+
+	// The slot still holds this frame's inputs until the index moves on
+	upscaling->CaptureInputs(frameRing.GetTimeline());
 
 	// Update the frame index
 	frameIndex = swapChain->GetCurrentBackBufferIndex();
 
-	// Clear resources
+	// FSR's interpolation queue may still read the slot's HUDless colour after the completion fence has passed
+	if (interpolationPending[frameIndex]) {
+		ZoneScopedNC("Interpolation wait", TRACY_WAIT_COLOR);
+		interpolationWaits.Add(FidelityFX::GetSingleton()->WaitForInterpolation(interpolationFrames[frameIndex]));
+		interpolationPending[frameIndex] = false;
+	}
+
+	// D3D11 must not write the slot while D3D12 may still read it
+	DX::ThrowIfFailed(d3d11Context->Wait(completionFence11.get(), frameRing.GetReuseValue(frameIndex)));
+
+	// Point the game at the next back buffer
+	if (!enbLoaded) {
+		auto backBuffer = swapChainBufferWrapped[frameIndex];
+		upscaling->SetFrameBuffer(backBuffer->resource11, backBuffer->rtv, backBuffer->srv);
+	}
+
+	// The game renders the next frame's motion vectors straight into the slot's shared texture
+	upscaling->SetMotionVectorBuffer(frameIndex);
+
+	// Discard the next frame's inputs
 	upscaling->Reset();
 
-	// Fix game running too fast
-	if (!upscaling->highFPSPhysicsFixLoaded)
-		upscaling->GameFrameLimiter();
+	if (!upscaling->settings.lowLatencyMode) {
+		// Fix game running too fast
+		if (!upscaling->highFPSPhysicsFixLoaded)
+			upscaling->GameFrameLimiter();
 
-	// If VSync is disabled, use frame limiter to prevent tearing and optimize pacing
-	if (SyncInterval == 0)
-		upscaling->FrameLimiter(useFrameGenerationThisFrame);
+		// If VSync is disabled, use frame limiter to prevent tearing and optimize pacing
+		if (SyncInterval == 0)
+			upscaling->FrameLimiter(useFrameGenerationThisFrame);
+	}
+
+	telemetry->EndFrame();
+
+	lowLatency->QueueFrameStart(SyncInterval == 0, useFrameGenerationThisFrame);
 
 	return S_OK;
 }
 
+HRESULT DX12SwapChain::ResizeBuffers(UINT Width, UINT Height, DXGI_FORMAT NewFormat)
+{
+	ZoneScoped;
+
+	auto upscaling = Upscaling::GetSingleton();
+	auto fidelityFX = FidelityFX::GetSingleton();
+
+	if (NewFormat == DXGI_FORMAT_UNKNOWN)
+		NewFormat = swapChainDesc.Format;
+
+	if (Width == swapChainDesc.Width && Height == swapChainDesc.Height && NewFormat == swapChainDesc.Format && !fullscreenChanged)
+		return S_OK;
+
+	fullscreenChanged = false;
+
+	int64_t start = upscaling->clock.Now();
+
+	// Nothing queued may still read the buffers that are about to go away
+	Drain();
+
+	int64_t drained = upscaling->clock.Now();
+
+	// The swap chain refuses to resize while any reference to its buffers is alive
+	for (uint32_t i = 0; i < frameRing.GetDepth(); i++) {
+		stateTracker.Untrack(swapChainBuffers[i].get());
+		swapChainBuffers[i] = nullptr;
+	}
+
+	HRESULT hr = swapChain->ResizeBuffers(frameRing.GetDepth(), Width, Height, NewFormat, swapChainDesc.Flags);
+	if (FAILED(hr)) {
+		logger::error("[Frame Generation] Failed to resize swap chain to {}x{}: {:X}", Width, Height, (uint32_t)hr);
+	}
+
+	// Zero sizes are resolved from the window by the swap chain
+	DX::ThrowIfFailed(swapChain->GetDesc1(&swapChainDesc));
+
+	for (uint32_t i = 0; i < frameRing.GetDepth(); i++) {
+		DX::ThrowIfFailed(swapChain->GetBuffer(i, IID_PPV_ARGS(&swapChainBuffers[i])));
+		stateTracker.Track(swapChainBuffers[i].get(), D3D12_RESOURCE_STATE_PRESENT);
+	}
+
+	CreateWrappedBuffers();
+	RecordCopyCommandLists();
+
+	// The frame generation context is created for one display size
+	ffx::DestroyContext(fidelityFX->frameGenContext);
+	fidelityFX->SetupFrameGeneration();
+
+	frameIndex = swapChain->GetCurrentBackBufferIndex();
+
+	if (!enbLoaded) {
+		auto backBuffer = swapChainBufferWrapped[frameIndex];
+		upscaling->SetFrameBuffer(backBuffer->resource11, backBuffer->rtv, backBuffer->srv);
+	}
+
+	upscaling->SetMotionVectorBuffer(frameIndex);
+
+	// Shared frame generation inputs are checked against the game's render targets before the next use
+	upscaling->setupBuffers = false;
+
+	double ticksToMs = 1000.0 / double(upscaling->clock.Frequency());
+	logger::info("[Frame Generation] Resized swap chain to {}x{} in {:.3f} ms, {:.3f} ms of it draining the GPU",
+		swapChainDesc.Width, swapChainDesc.Height, double(upscaling->clock.Now() - start) * ticksToMs, double(drained - start) * ticksToMs);
+
+	return hr;
+}
+
+HRESULT DX12SwapChain::SetFullscreenState(BOOL Fullscreen, IDXGIOutput* pTarget)
+{
+	ZoneScoped;
+
+	BOOL fullscreen = FALSE;
+	if (SUCCEEDED(swapChain->GetFullscreenState(&fullscreen, nullptr)) && fullscreen == Fullscreen)
+		return S_OK;
+
+	// The mode change releases the display, nothing may be in flight to it, FSR's queued presents included
+	Drain();
+
+	HRESULT hr = swapChain->SetFullscreenState(Fullscreen, pTarget);
+	if (FAILED(hr)) {
+		logger::warn("[Frame Generation] Failed to switch to {}: {:X}", Fullscreen ? "fullscreen" : "windowed", (uint32_t)hr);
+		return hr;
+	}
+
+	logger::info("[Frame Generation] Switched to {}", Fullscreen ? "fullscreen" : "windowed");
+
+	// The game follows up with ResizeBuffers once its window settles
+	fullscreenChanged = true;
+	presentModeKnown = false;
+	Upscaling::GetSingleton()->lastFrameStatistics = {};
+
+	return hr;
+}
+
+void DX12SwapChain::Drain()
+{
+	WaitForCompletion(frameRing.GetTimeline());
+
+	ffx::DispatchDescFrameGenerationSwapChainWaitForPresentsDX12 waitForPresents{};
+	if (ffx::Dispatch(FidelityFX::GetSingleton()->swapChainContext, waitForPresents) != ffx::ReturnCode::Ok) {
+		logger::critical("[FidelityFX] Failed to wait for presents!");
+	}
+}
+
+bool DX12SwapChain::WindowSizeChanged()
+{
+	HWND hwnd = nullptr;
+	if (!swapChain || FAILED(swapChain->GetHwnd(&hwnd)))
+		return false;
+
+	RECT rect{};
+	if (!GetClientRect(hwnd, &rect))
+		return false;
+
+	// A minimised window has no client area, the swap chain keeps its size
+	auto width = UINT(rect.right - rect.left);
+	auto height = UINT(rect.bottom - rect.top);
+	if (!width || !height)
+		return false;
+
+	return width != swapChainDesc.Width || height != swapChainDesc.Height || fullscreenChanged;
+}
+
+void DX12SwapChain::CheckPresentMode()
+{
+	if (!swapChainMedia)
+		return;
+
+	DXGI_FRAME_STATISTICS_MEDIA statistics{};
+	if (FAILED(swapChainMedia->GetFrameStatisticsMedia(&statistics)))
+		return;
+
+	if (presentModeKnown && statistics.CompositionMode == presentMode)
+		return;
+
+	presentMode = statistics.CompositionMode;
+	presentModeKnown = true;
+
+	switch (presentMode) {
+	case DXGI_FRAME_PRESENTATION_MODE_COMPOSED:
+		logger::warn("[Frame Generation] Present mode: composed, the compositor adds a frame of latency");
+		break;
+	case DXGI_FRAME_PRESENTATION_MODE_OVERLAY:
+		logger::info("[Frame Generation] Present mode: hardware overlay");
+		break;
+	case DXGI_FRAME_PRESENTATION_MODE_NONE:
+		logger::info("[Frame Generation] Present mode: independent flip");
+		break;
+	default:
+		logger::warn("[Frame Generation] Present mode: composition failure");
+		break;
+	}
+}
+
+void DX12SwapChain::WaitForFrameLatency()
+{
+	if (!frameLatencyWaitableObject)
+		return;
+
+	ZoneScopedNC("Frame latency wait", TRACY_WAIT_COLOR);
+
+	auto telemetry = Telemetry::GetSingleton();
+	telemetry->Mark(Telemetry::Event::kFrameLatencyWait);
+
+	// Timeout so a lost present, e.g. during a mode change, cannot hang the game
+	WaitForSingleObjectEx(frameLatencyWaitableObject, 1000, TRUE);
+
+	telemetry->Mark(Telemetry::Event::kFrameLatencyWaitReturn);
+}
+
+int64_t DX12SwapChain::WaitForCompletion(uint64_t a_value)
+{
+	if (completionFence12->GetCompletedValue() >= a_value)
+		return 0;
+
+	auto& clock = Upscaling::GetSingleton()->clock;
+	int64_t start = clock.Now();
+
+	DX::ThrowIfFailed(completionFence12->SetEventOnCompletion(a_value, completionEvent));
+	WaitForSingleObject(completionEvent, INFINITE);
+
+	return clock.Now() - start;
+}
+
 HRESULT DX12SwapChain::GetDevice(REFIID uuid, void** ppDevice)
 {
 	if (uuid == __uuidof(ID3D11Device) || uuid == __uuidof(ID3D11Device1) || uuid == __uuidof(ID3D11Device2) || uuid == __uuidof(ID3D11Device3) || uuid == __uuidof(ID3D11Device4) || uuid == __uuidof(ID3D11Device5)) {
@@ -219,6 +617,8 @@ HRESULT DX12SwapChain::GetDevice(REFIID uuid, void** ppDevice)
 
 WrappedResource::WrappedResource(D3D11_TEXTURE2D_DESC a_texDesc, ID3D11Device5* a_d3d11Device, ID3D12Device* a_d3d12Device)
 {
+	desc = a_texDesc;
+
 	// Create D3D11 shared texture directly instead of wrapping D3D12 resource
 	a_texDesc.MiscFlags |= D3D11_RESOURCE_MISC_SHARED | D3D11_RESOURCE_MISC_SHARED_NTHANDLE;
 	DX::ThrowIfFailed(a_d3d11Device->CreateTexture2D(&a_texDesc, nullptr, &resource11));
@@ -272,6 +672,18 @@ WrappedResource::WrappedResource(D3D11_TEXTURE2D_DESC a_texDesc, ID3D11Device5*
 	}
 }
 
+WrappedResource::~WrappedResource()
+{
+	if (rtv)
+		rtv->Release();
+	if (uav)
+		uav->Release();
+	if (srv)
+		srv->Release();
+	if (resource11)
+		resource11->Release();
+}
+
 DXGISwapChainProxy::DXGISwapChainProxy(IDXGISwapChain4* a_swapChain)
 {
 	swapChain = a_swapChain;
@@ -334,9 +746,9 @@ HRESULT STDMETHODCALLTYPE DXGISwapChainProxy::GetBuffer(UINT, _In_ REFIID, _COM_
 	return DX12SwapChain::GetSingleton()->GetBuffer(ppSurface);
 }
 
-HRESULT STDMETHODCALLTYPE DXGISwapChainProxy::SetFullscreenState(BOOL, _In_opt_ IDXGIOutput*)
+HRESULT STDMETHODCALLTYPE DXGISwapChainProxy::SetFullscreenState(BOOL Fullscreen, _In_opt_ IDXGIOutput* pTarget)
 {
-	return S_OK;
+	return DX12SwapChain::GetSingleton()->SetFullscreenState(Fullscreen, pTarget);
 }
 
 HRESULT STDMETHODCALLTYPE DXGISwapChainProxy::GetFullscreenState(_Out_opt_ BOOL* pFullscreen, _COM_Outptr_opt_result_maybenull_ IDXGIOutput** ppTarget)
@@ -349,14 +761,15 @@ HRESULT STDMETHODCALLTYPE DXGISwapChainProxy::GetDesc(_Out_ DXGI_SWAP_CHAIN_DESC
 	return swapChain->GetDesc(pDesc);
 }
 
-HRESULT STDMETHODCALLTYPE DXGISwapChainProxy::ResizeBuffers(UINT , UINT , UINT , DXGI_FORMAT , UINT )
+HRESULT STDMETHODCALLTYPE DXGISwapChainProxy::ResizeBuffers(UINT, UINT Width, UINT Height, DXGI_FORMAT NewFormat, UINT)
 {
-	return S_OK;
+	// The buffer count and flags belong to the real swap chain
+	return DX12SwapChain::GetSingleton()->ResizeBuffers(Width, Height, NewFormat);
 }
 
-HRESULT STDMETHODCALLTYPE DXGISwapChainProxy::ResizeTarget(_In_ const DXGI_MODE_DESC*)
+HRESULT STDMETHODCALLTYPE DXGISwapChainProxy::ResizeTarget(_In_ const DXGI_MODE_DESC* pNewTargetParameters)
 {
-	return S_OK;
+	return swapChain->ResizeTarget(pNewTargetParameters);
 }
 
 HRESULT STDMETHODCALLTYPE DXGISwapChainProxy::GetContainingOutput(_COM_Outptr_ IDXGIOutput** ppOutput)
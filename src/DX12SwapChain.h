@@ -10,16 +10,20 @@
 #include <d3d12.h>
 
 #include "Buffer.h"
+#include "FrameRing.h"
+#include "ResourceStateTracker.h"
 
 class WrappedResource
 {
 public:
 	WrappedResource(D3D11_TEXTURE2D_DESC a_texDesc, ID3D11Device5* a_d3d11Device, ID3D12Device* a_d3d12Device);
+	~WrappedResource();
 
-	ID3D11Texture2D* resource11;
-	ID3D11ShaderResourceView* srv;
-	ID3D11UnorderedAccessView* uav;
-	ID3D11RenderTargetView* rtv;
+	D3D11_TEXTURE2D_DESC desc;
+	ID3D11Texture2D* resource11 = nullptr;
+	ID3D11ShaderResourceView* srv = nullptr;
+	ID3D11UnorderedAccessView* uav = nullptr;
+	ID3D11RenderTargetView* rtv = nullptr;
 	winrt::com_ptr<ID3D12Resource> resource;
 };
 
@@ -68,17 +72,35 @@ public:
 
 	winrt::com_ptr<ID3D12Device> d3d12Device;
 	winrt::com_ptr<ID3D12CommandQueue> commandQueue;
-	winrt::com_ptr<ID3D12CommandAllocator> commandAllocators[2];
-	winrt::com_ptr<ID3D12GraphicsCommandList4> commandLists[2];
+	winrt::com_ptr<ID3D12CommandAllocator> commandAllocators[FrameRing::kMaxDepth];
+	winrt::com_ptr<ID3D12GraphicsCommandList4> commandLists[FrameRing::kMaxDepth];
+
+	// Optional COPY or COMPUTE queue the swap chain copy runs on, so it overlaps work on the game queue
+	winrt::com_ptr<ID3D12CommandQueue> transferQueue;
+	winrt::com_ptr<ID3D12Fence> transferFence;
+	UINT64 transferFenceValue = 0;
+
+	// Recorded once per slot, replayed every frame
+	winrt::com_ptr<ID3D12CommandAllocator> copyCommandAllocators[FrameRing::kMaxDepth];
+	winrt::com_ptr<ID3D12GraphicsCommandList4> copyCommandLists[FrameRing::kMaxDepth];
 
 	IDXGISwapChain4* swapChain;
 
 	DXGI_SWAP_CHAIN_DESC1 swapChainDesc;
+	DXGI_SWAP_CHAIN_FULLSCREEN_DESC fullscreenDesc;
+
+	// Composition costs a frame of latency, so the mode actually in effect is reported whenever it changes
+	winrt::com_ptr<IDXGISwapChainMedia> swapChainMedia;
+	DXGI_FRAME_PRESENTATION_MODE presentMode = DXGI_FRAME_PRESENTATION_MODE_COMPOSITION_FAILURE;
+	bool presentModeKnown = false;
+
+	// Flip model buffers must be resized after a fullscreen transition even when the size is unchanged
+	bool fullscreenChanged = false;
 
-	Texture2D* swapChainBufferProxy;
-	WrappedResource* swapChainBufferProxyENB;
+	WrappedResource* swapChainBufferProxyENB = nullptr;
 
-	WrappedResource* swapChainBufferWrapped[2];
+	// Without ENB these are the back buffers the game renders to
+	WrappedResource* swapChainBufferWrapped[FrameRing::kMaxDepth]{};
 
 	winrt::com_ptr<ID3D11Device5> d3d11Device;
 	winrt::com_ptr<ID3D11DeviceContext4> d3d11Context;
@@ -86,7 +108,27 @@ public:
 	winrt::com_ptr<ID3D11Fence> d3d11Fence;
 	winrt::com_ptr<ID3D12Fence> d3d12Fence;
 
-	winrt::com_ptr<ID3D12Resource> swapChainBuffers[2];
+	// Signalled by D3D12 when a slot is retired, waited on by D3D11 before reusing it
+	winrt::com_ptr<ID3D12Fence> completionFence12;
+	winrt::com_ptr<ID3D11Fence> completionFence11;
+	HANDLE completionEvent = nullptr;
+
+	HANDLE frameLatencyWaitableObject = nullptr;
+
+	FrameRing::WaitStats framesAheadWaits;
+	FrameRing::WaitStats slotReuseWaits;
+	FrameRing::WaitStats interpolationWaits;
+
+	// FSR frame of each slot's last interpolation, which reads the inputs outside the completion fence
+	uint64_t interpolationFrames[FrameRing::kMaxDepth]{};
+	bool interpolationPending[FrameRing::kMaxDepth]{};
+
+	winrt::com_ptr<ID3D12Resource> swapChainBuffers[FrameRing::kMaxDepth];
+
+	FrameRing frameRing;
+
+	// State of every D3D12 resource the plugin owns, as seen between submissions
+	ResourceStateTracker<ID3D12GraphicsCommandList> stateTracker;
 
 	UINT frameIndex = 0;
 	UINT64 fenceValue = 0;
@@ -99,12 +141,33 @@ public:
 	void CreateSwapChain(IDXGIFactory5* a_dxgiFactory, DXGI_SWAP_CHAIN_DESC swapChainDesc);
 
 	void CreateInterop();
+	void CreateWrappedBuffers();
+	void RecordCopyCommandLists();
 
 	DXGISwapChainProxy* GetSwapChainProxy();
 	void SetD3D11Device(ID3D11Device* a_d3d11Device);
 	void SetD3D11DeviceContext(ID3D11DeviceContext* a_d3d11Context);
 
+	// Logs the present mode when it changes, checked every few frames after Present
+	void CheckPresentMode();
+
+	// Waits for every retired frame and FSR's queued presents, afterwards nothing in flight reads the plugin's resources
+	void Drain();
+
+	// True when the window's client area no longer matches the swap chain, or a fullscreen switch is waiting for its resize
+	bool WindowSizeChanged();
+
+	// Blocks until the swap chain can queue another frame, called at the start of each simulation tick
+	void WaitForFrameLatency();
+
+	// Blocks until the completion fence reaches the value, returns the QPC ticks spent waiting
+	int64_t WaitForCompletion(uint64_t a_value);
+
 	HRESULT GetBuffer(void** ppSurface);
 	HRESULT Present(UINT SyncInterval, UINT Flags);
+
+	// Drains the GPU and FSR's present queue, then rebuilds everything sized from the swap chain
+	HRESULT ResizeBuffers(UINT Width, UINT Height, DXGI_FORMAT NewFormat);
+	HRESULT SetFullscreenState(BOOL Fullscreen, IDXGIOutput* pTarget);
 	HRESULT GetDevice(_In_ REFIID riid, _COM_Outptr_ void** ppDevice);
 };
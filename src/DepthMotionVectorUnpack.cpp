@@ -0,0 +1,127 @@
+#include "DepthMotionVectorUnpack.h"
+
+#include <d3dcompiler.h>
+
+bool DepthMotionVectorUnpack::CreatePipeline(ID3D12Device* a_device)
+{
+	if (pipelineState)
+		return true;
+
+	winrt::com_ptr<ID3DBlob> shaderBlob;
+	winrt::com_ptr<ID3DBlob> shaderErrors;
+
+	uint32_t flags = D3DCOMPILE_ENABLE_STRICTNESS | D3DCOMPILE_OPTIMIZATION_LEVEL3;
+	if (FAILED(D3DCompileFromFile(L"Data\\F4SE\\Plugins\\FrameGeneration\\UnpackDepthMotionVectorsCS.hlsl", nullptr, D3D_COMPILE_STANDARD_FILE_INCLUDE, "main", "cs_5_0", flags, 0, shaderBlob.put(), shaderErrors.put()))) {
+		logger::warn("Shader compilation failed:\n\n{}", shaderErrors ? static_cast<char*>(shaderErrors->GetBufferPointer()) : "Unknown error");
+		return false;
+	}
+
+	CD3DX12_DESCRIPTOR_RANGE ranges[2];
+	ranges[0].Init(D3D12_DESCRIPTOR_RANGE_TYPE_SRV, 1, 0);
+	ranges[1].Init(D3D12_DESCRIPTOR_RANGE_TYPE_UAV, 2, 0);
+
+	CD3DX12_ROOT_PARAMETER rootParameter;
+	rootParameter.InitAsDescriptorTable(ARRAYSIZE(ranges), ranges);
+
+	CD3DX12_ROOT_SIGNATURE_DESC rootSignatureDesc(1, &rootParameter);
+
+	winrt::com_ptr<ID3DBlob> rootSignatureBlob;
+	DX::ThrowIfFailed(D3D12SerializeRootSignature(&rootSignatureDesc, D3D_ROOT_SIGNATURE_VERSION_1, rootSignatureBlob.put(), nullptr));
+	DX::ThrowIfFailed(a_device->CreateRootSignature(0, rootSignatureBlob->GetBufferPointer(), rootSignatureBlob->GetBufferSize(), IID_PPV_ARGS(&rootSignature)));
+
+	D3D12_COMPUTE_PIPELINE_STATE_DESC pipelineDesc{};
+	pipelineDesc.pRootSignature = rootSignature.get();
+	pipelineDesc.CS = { shaderBlob->GetBufferPointer(), shaderBlob->GetBufferSize() };
+	DX::ThrowIfFailed(a_device->CreateComputePipelineState(&pipelineDesc, IID_PPV_ARGS(&pipelineState)));
+
+	D3D12_DESCRIPTOR_HEAP_DESC heapDesc{};
+	heapDesc.Type = D3D12_DESCRIPTOR_HEAP_TYPE_CBV_SRV_UAV;
+	heapDesc.NumDescriptors = FrameRing::kMaxDepth * kDescriptorsPerSlot;
+	heapDesc.Flags = D3D12_DESCRIPTOR_HEAP_FLAG_SHADER_VISIBLE;
+	DX::ThrowIfFailed(a_device->CreateDescriptorHeap(&heapDesc, IID_PPV_ARGS(&descriptorHeap)));
+
+	descriptorSize = a_device->GetDescriptorHandleIncrementSize(D3D12_DESCRIPTOR_HEAP_TYPE_CBV_SRV_UAV);
+	return true;
+}
+
+void DepthMotionVectorUnpack::CreateResources(ID3D12Device* a_device, ID3D12Resource* const* a_packed, uint32_t a_count, DXGI_FORMAT a_motionVectorFormat, ResourceStateTracker<ID3D12GraphicsCommandList>& a_stateTracker)
+{
+	auto packedDesc = a_packed[0]->GetDesc();
+	width = (uint32_t)packedDesc.Width;
+	height = packedDesc.Height;
+
+	auto heapProperties = CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_DEFAULT);
+
+	for (uint32_t index = 0; index < a_count; index++) {
+		packed[index] = a_packed[index];
+
+		auto texDesc = CD3DX12_RESOURCE_DESC::Tex2D(DXGI_FORMAT_R32_FLOAT, width, height, 1, 1, 1, 0, D3D12_RESOURCE_FLAG_ALLOW_UNORDERED_ACCESS);
+		DX::ThrowIfFailed(a_device->CreateCommittedResource(&heapProperties, D3D12_HEAP_FLAG_NONE, &texDesc, D3D12_RESOURCE_STATE_COMMON, nullptr, IID_PPV_ARGS(&depth[index])));
+
+		texDesc.Format = a_motionVectorFormat;
+		DX::ThrowIfFailed(a_device->CreateCommittedResource(&heapProperties, D3D12_HEAP_FLAG_NONE, &texDesc, D3D12_RESOURCE_STATE_COMMON, nullptr, IID_PPV_ARGS(&motionVectors[index])));
+
+		a_stateTracker.Track(depth[index].get(), D3D12_RESOURCE_STATE_COMMON);
+		a_stateTracker.Track(motionVectors[index].get(), D3D12_RESOURCE_STATE_COMMON);
+
+		if (!descriptorHeap)
+			continue;
+
+		CD3DX12_CPU_DESCRIPTOR_HANDLE handle(descriptorHeap->GetCPUDescriptorHandleForHeapStart(), index * kDescriptorsPerSlot, descriptorSize);
+
+		D3D12_SHADER_RESOURCE_VIEW_DESC srvDesc{};
+		srvDesc.Format = kPackedFormat;
+		srvDesc.ViewDimension = D3D12_SRV_DIMENSION_TEXTURE2D;
+		srvDesc.Shader4ComponentMapping = D3D12_DEFAULT_SHADER_4_COMPONENT_MAPPING;
+		srvDesc.Texture2D.MipLevels = 1;
+		a_device->CreateShaderResourceView(packed[index], &srvDesc, handle);
+
+		D3D12_UNORDERED_ACCESS_VIEW_DESC uavDesc{};
+		uavDesc.ViewDimension = D3D12_UAV_DIMENSION_TEXTURE2D;
+
+		uavDesc.Format = DXGI_FORMAT_R32_FLOAT;
+		a_device->CreateUnorderedAccessView(depth[index].get(), nullptr, &uavDesc, handle.Offset(1, descriptorSize));
+
+		uavDesc.Format = a_motionVectorFormat;
+		a_device->CreateUnorderedAccessView(motionVectors[index].get(), nullptr, &uavDesc, handle.Offset(1, descriptorSize));
+	}
+}
+
+void DepthMotionVectorUnpack::ReleaseResources(ResourceStateTracker<ID3D12GraphicsCommandList>& a_stateTracker)
+{
+	for (uint32_t index = 0; index < FrameRing::kMaxDepth; index++) {
+		if (depth[index])
+			a_stateTracker.Untrack(depth[index].get());
+		if (motionVectors[index])
+			a_stateTracker.Untrack(motionVectors[index].get());
+
+		depth[index] = nullptr;
+		motionVectors[index] = nullptr;
+		packed[index] = nullptr;
+	}
+}
+
+void DepthMotionVectorUnpack::Dispatch(ID3D12GraphicsCommandList* a_commandList, uint32_t a_slot, uint32_t a_width, uint32_t a_height, ResourceStateTracker<ID3D12GraphicsCommandList>& a_stateTracker)
+{
+	if (!pipelineState || !packed[a_slot])
+		return;
+
+	a_stateTracker.Transition(packed[a_slot], D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE);
+	a_stateTracker.Transition(depth[a_slot].get(), D3D12_RESOURCE_STATE_UNORDERED_ACCESS);
+	a_stateTracker.Transition(motionVectors[a_slot].get(), D3D12_RESOURCE_STATE_UNORDERED_ACCESS);
+	a_stateTracker.Flush(a_commandList);
+
+	ID3D12DescriptorHeap* heaps[] = { descriptorHeap.get() };
+	a_commandList->SetDescriptorHeaps(ARRAYSIZE(heaps), heaps);
+	a_commandList->SetComputeRootSignature(rootSignature.get());
+	a_commandList->SetPipelineState(pipelineState.get());
+	a_commandList->SetComputeRootDescriptorTable(0, CD3DX12_GPU_DESCRIPTOR_HANDLE(descriptorHeap->GetGPUDescriptorHandleForHeapStart(), a_slot * kDescriptorsPerSlot, descriptorSize));
+
+	a_commandList->Dispatch((std::min(a_width, width) + 7) / 8, (std::min(a_height, height) + 7) / 8, 1);
+
+	// D3D11 writes the packed texture again next time the slot comes round
+	a_stateTracker.Transition(packed[a_slot], D3D12_RESOURCE_STATE_COMMON);
+	a_stateTracker.Transition(depth[a_slot].get(), D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE);
+	a_stateTracker.Transition(motionVectors[a_slot].get(), D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE);
+	a_stateTracker.Flush(a_commandList);
+}
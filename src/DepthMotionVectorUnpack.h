@@ -0,0 +1,49 @@
+#pragma once
+
+#include <winrt/base.h>
+
+#include <d3d12.h>
+
+#include "FrameRing.h"
+#include "ResourceStateTracker.h"
+
+// Splits the packed depth and motion vector texture shared by D3D11 into the separate typed
+// textures FSR takes, one dispatch on the game queue right before frame generation prepare
+class DepthMotionVectorUnpack
+{
+public:
+	static DepthMotionVectorUnpack* GetSingleton()
+	{
+		static DepthMotionVectorUnpack singleton;
+		return &singleton;
+	}
+
+	static constexpr DXGI_FORMAT kPackedFormat = DXGI_FORMAT_R32G32_UINT;
+
+	// Written by D3D12 only, so they are never shared
+	winrt::com_ptr<ID3D12Resource> depth[FrameRing::kMaxDepth];
+	winrt::com_ptr<ID3D12Resource> motionVectors[FrameRing::kMaxDepth];
+
+	// Compiles the unpack shader once, false if it is unavailable and nothing may be shared packed
+	bool CreatePipeline(ID3D12Device* a_device);
+
+	// One set per frame ring slot, matching the packed textures
+	void CreateResources(ID3D12Device* a_device, ID3D12Resource* const* a_packed, uint32_t a_count, DXGI_FORMAT a_motionVectorFormat, ResourceStateTracker<ID3D12GraphicsCommandList>& a_stateTracker);
+	void ReleaseResources(ResourceStateTracker<ID3D12GraphicsCommandList>& a_stateTracker);
+
+	// Unpacks the top left region the game rendered, leaves the unpacked textures in NON_PIXEL_SHADER_RESOURCE and the packed one in COMMON
+	void Dispatch(ID3D12GraphicsCommandList* a_commandList, uint32_t a_slot, uint32_t a_width, uint32_t a_height, ResourceStateTracker<ID3D12GraphicsCommandList>& a_stateTracker);
+
+private:
+	// Packed SRV, depth UAV and motion vector UAV per slot
+	static constexpr uint32_t kDescriptorsPerSlot = 3;
+
+	winrt::com_ptr<ID3D12RootSignature> rootSignature;
+	winrt::com_ptr<ID3D12PipelineState> pipelineState;
+	winrt::com_ptr<ID3D12DescriptorHeap> descriptorHeap;
+	uint32_t descriptorSize = 0;
+
+	ID3D12Resource* packed[FrameRing::kMaxDepth]{};
+	uint32_t width = 0;
+	uint32_t height = 0;
+};
@@ -0,0 +1,152 @@
+#include "DisplayWatcher.h"
+
+#include "Upscaling.h"
+
+void DisplayWatcher::Start(HWND a_window)
+{
+	// Subclassing twice would store WndProc as its own original and recurse forever
+	if (window) {
+		if (a_window != window)
+			logger::warn("[Frame Generation] Refresh rate is already watched on another window, ignoring the new one");
+		return;
+	}
+
+	window = a_window;
+	monitor = MonitorFromWindow(window, MONITOR_DEFAULTTONEAREST);
+
+	// The first query is synchronous, the swap chain has not been created yet
+	UpdateDisplayCache();
+	Upscaling::GetSingleton()->refreshRate = GetRefreshRate(monitor);
+
+	logger::info("[Frame Generation] Refresh rate {:.3f} Hz", Upscaling::GetSingleton()->refreshRate.load());
+
+	changeEvent = CreateEvent(nullptr, FALSE, FALSE, nullptr);
+
+	unicodeWindow = IsWindowUnicode(window);
+	if (unicodeWindow)
+		originalWndProc = (WNDPROC)SetWindowLongPtrW(window, GWLP_WNDPROC, (LONG_PTR)WndProc);
+	else
+		originalWndProc = (WNDPROC)SetWindowLongPtrA(window, GWLP_WNDPROC, (LONG_PTR)WndProc);
+
+	if (!originalWndProc)
+		logger::warn("[Frame Generation] Failed to watch the game window, refresh rate changes will be missed");
+
+	watchThread = std::jthread([this](std::stop_token a_stopToken) { Watch(a_stopToken); });
+}
+
+LRESULT CALLBACK DisplayWatcher::WndProc(HWND a_window, UINT a_message, WPARAM a_wParam, LPARAM a_lParam)
+{
+	auto displayWatcher = GetSingleton();
+
+	switch (a_message) {
+	case WM_DISPLAYCHANGE:
+		displayWatcher->topologyChanged = true;
+		displayWatcher->monitor = MonitorFromWindow(a_window, MONITOR_DEFAULTTONEAREST);
+		SetEvent(displayWatcher->changeEvent);
+		break;
+	case WM_WINDOWPOSCHANGED:
+		{
+			// Cheap enough to check on every move, the worker only wakes when the monitor differs
+			HMONITOR currentMonitor = MonitorFromWindow(a_window, MONITOR_DEFAULTTONEAREST);
+			if (displayWatcher->monitor.exchange(currentMonitor) != currentMonitor)
+				SetEvent(displayWatcher->changeEvent);
+			break;
+		}
+	}
+
+	if (displayWatcher->unicodeWindow)
+		return CallWindowProcW(displayWatcher->originalWndProc, a_window, a_message, a_wParam, a_lParam);
+	return CallWindowProcA(displayWatcher->originalWndProc, a_window, a_message, a_wParam, a_lParam);
+}
+
+void DisplayWatcher::Watch(std::stop_token a_stopToken)
+{
+	auto upscaling = Upscaling::GetSingleton();
+
+	while (!a_stopToken.stop_requested()) {
+		if (WaitForSingleObject(changeEvent, 100) != WAIT_OBJECT_0)
+			continue;
+
+		if (topologyChanged.exchange(false))
+			UpdateDisplayCache();
+
+		double refreshRate = GetRefreshRate(monitor);
+		if (refreshRate != upscaling->refreshRate.exchange(refreshRate))
+			logger::info("[Frame Generation] Refresh rate changed to {:.3f} Hz", refreshRate);
+	}
+}
+
+/*
+* Copyright (c) 2022-2023 NVIDIA CORPORATION. All rights reserved
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+void DisplayWatcher::UpdateDisplayCache()
+{
+	refreshRates.clear();
+
+	// using the CCD get every active path and display configuration at once
+	UINT32 requiredPaths, requiredModes;
+	if (GetDisplayConfigBufferSizes(QDC_ONLY_ACTIVE_PATHS, &requiredPaths, &requiredModes) != ERROR_SUCCESS)
+		return;
+
+	std::vector<DISPLAYCONFIG_PATH_INFO> paths(requiredPaths);
+	std::vector<DISPLAYCONFIG_MODE_INFO> modes2(requiredModes);
+	if (QueryDisplayConfig(QDC_ONLY_ACTIVE_PATHS, &requiredPaths, paths.data(), &requiredModes, modes2.data(), nullptr) != ERROR_SUCCESS)
+		return;
+
+	for (uint32_t i = 0; i < requiredPaths; i++) {
+		auto& p = paths[i];
+		DISPLAYCONFIG_SOURCE_DEVICE_NAME sourceName;
+		sourceName.header.type = DISPLAYCONFIG_DEVICE_INFO_GET_SOURCE_NAME;
+		sourceName.header.size = sizeof(sourceName);
+		sourceName.header.adapterId = p.sourceInfo.adapterId;
+		sourceName.header.id = p.sourceInfo.id;
+		if (DisplayConfigGetDeviceInfo(&sourceName.header) == ERROR_SUCCESS) {
+			// there may be the possibility that display may be duplicated and windows may be one of them in such scenario
+			// there may be two paths because source is same target will be different
+			// as window is on both the display so either selecting either one is ok
+			UINT numerator = p.targetInfo.refreshRate.Numerator;
+			UINT denominator = p.targetInfo.refreshRate.Denominator;
+			if (denominator)
+				refreshRates.emplace(sourceName.viewGdiDeviceName, (double)numerator / (double)denominator);
+		}
+	}
+}
+
+double DisplayWatcher::GetRefreshRate(HMONITOR a_monitor)
+{
+	MONITORINFOEXW info;
+	info.cbSize = sizeof(info);
+	if (GetMonitorInfoW(a_monitor, &info) != 0) {
+		auto cached = refreshRates.find(info.szDevice);
+
+		// A monitor that is not cached yet means the topology changed without a WM_DISPLAYCHANGE reaching us
+		if (cached == refreshRates.end()) {
+			UpdateDisplayCache();
+			cached = refreshRates.find(info.szDevice);
+		}
+
+		if (cached != refreshRates.end())
+			return cached->second;
+	}
+	logger::error("[Frame Generation] Failed to look up the refresh rate of the monitor through CCD, assuming 60 Hz");
+	return 60;
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <atomic>
+#include <string>
+#include <thread>
+#include <unordered_map>
+
+// Keeps Upscaling::refreshRate in sync with the monitor the game window is on. The window
+// procedure only flags changes, the CCD queries run on a worker thread and are cached per display
+class DisplayWatcher
+{
+public:
+	static DisplayWatcher* GetSingleton()
+	{
+		static DisplayWatcher singleton;
+		return &singleton;
+	}
+
+	void Start(HWND a_window);
+
+private:
+	static LRESULT CALLBACK WndProc(HWND a_window, UINT a_message, WPARAM a_wParam, LPARAM a_lParam);
+
+	void Watch(std::stop_token a_stopToken);
+	void UpdateDisplayCache();
+	double GetRefreshRate(HMONITOR a_monitor);
+
+	HWND window = nullptr;
+	WNDPROC originalWndProc = nullptr;
+	bool unicodeWindow = true;
+
+	HANDLE changeEvent = nullptr;
+	std::atomic<HMONITOR> monitor = nullptr;
+	std::atomic<bool> topologyChanged = false;
+
+	// GDI device name to refresh rate, only touched by the worker after Start
+	std::unordered_map<std::wstring, double> refreshRates;
+
+	std::jthread watchThread;
+};
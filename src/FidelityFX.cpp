@@ -3,6 +3,10 @@
 #include "Upscaling.h"
 
 #include "DX12SwapChain.h"
+#include "DepthMotionVectorUnpack.h"
+#include "GPUProfiler.h"
+#include "GameRenderState.h"
+#include "Telemetry.h"
 #include <dx12/ffx_api_dx12.hpp>
 
 ffxFunctions ffxModule;
@@ -21,6 +25,7 @@ void FidelityFX::SetupFrameGeneration()
 
 	ffx::CreateContextDescFrameGeneration createFg{};
 	createFg.displaySize = { dx12SwapChain->swapChainDesc.Width, dx12SwapChain->swapChainDesc.Height };
+	// Dynamic resolution only ever scales down, so the display size is also the largest render size
 	createFg.maxRenderSize = createFg.displaySize;
 	createFg.flags = FFX_FRAMEGENERATION_ENABLE_ASYNC_WORKLOAD_SUPPORT;
 	createFg.backBufferFormat = ffxApiGetSurfaceFormatDX12(dx12SwapChain->swapChainDesc.Format);
@@ -31,31 +36,89 @@ void FidelityFX::SetupFrameGeneration()
 	if (ffx::CreateContext(frameGenContext, nullptr, createFg, createBackend) != ffx::ReturnCode::Ok) {
 		logger::critical("[FidelityFX] Failed to create frame generation context!");
 	}
+
+	// Kept across resizes, the CPU reads it straight from the mapped readback heap
+	if (!interpolationMarker) {
+		auto heapProperties = CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_READBACK);
+		auto bufferDesc = CD3DX12_RESOURCE_DESC::Buffer(sizeof(uint32_t));
+		DX::ThrowIfFailed(dx12SwapChain->d3d12Device->CreateCommittedResource(&heapProperties, D3D12_HEAP_FLAG_NONE, &bufferDesc, D3D12_RESOURCE_STATE_COPY_DEST, nullptr, IID_PPV_ARGS(&interpolationMarker)));
+
+		void* data = nullptr;
+		DX::ThrowIfFailed(interpolationMarker->Map(0, nullptr, &data));
+		interpolationMarkerData = static_cast<volatile uint32_t*>(data);
+	}
 }
 
-[[nodiscard]] static RE::BSGraphics::State* State_GetSingleton()
+// Runs on FSR's present thread, the command list executes on its interpolation queue
+static ffxReturnCode_t DispatchFrameGeneration(ffxDispatchDescFrameGeneration* a_params, void* a_userContext)
 {
-#if defined(FALLOUT_POST_NG)
-	REL::Relocation<RE::BSGraphics::State*> singleton{ REL::ID(2704621) };
-#else
-	REL::Relocation<RE::BSGraphics::State*> singleton{ REL::ID(600795) };
-#endif
-	return singleton.get();
+	auto fidelityFX = static_cast<FidelityFX*>(a_userContext);
+
+	auto result = ffxModule.Dispatch(&fidelityFX->frameGenContext, &a_params->header);
+	if (result != FFX_API_RETURN_OK)
+		return result;
+
+	winrt::com_ptr<ID3D12GraphicsCommandList2> commandList;
+	if (SUCCEEDED(static_cast<ID3D12GraphicsCommandList*>(a_params->commandList)->QueryInterface(IID_PPV_ARGS(commandList.put())))) {
+		D3D12_WRITEBUFFERIMMEDIATE_PARAMETER marker{ fidelityFX->interpolationMarker->GetGPUVirtualAddress(), uint32_t(a_params->frameID + 1) };
+		D3D12_WRITEBUFFERIMMEDIATE_MODE mode = D3D12_WRITEBUFFERIMMEDIATE_MODE_MARKER_OUT;
+		commandList->WriteBufferImmediate(1, &marker, &mode);
+	}
+
+	return result;
 }
 
+int64_t FidelityFX::WaitForInterpolation(uint64_t a_frameID)
+{
+	// Wraps around like the 32-bit marker, a later frame's marker also covers this one
+	auto Finished = [&] { return int32_t(*interpolationMarkerData - uint32_t(a_frameID + 1)) >= 0; };
+
+	if (!interpolationMarkerData || Finished())
+		return 0;
+
+	auto& clock = Upscaling::GetSingleton()->clock;
+	int64_t start = clock.Now();
+	int64_t timeout = clock.Frequency() / 10;
+
+	// There is no fence for the interpolation queue, the marker is polled and a lost frame cannot hang the game
+	while (!Finished()) {
+		if (clock.Now() - start > timeout) {
+			logger::warn("[FidelityFX] Interpolation of frame {} did not finish within 100 ms", a_frameID);
+			break;
+		}
+		SwitchToThread();
+	}
+
+	return clock.Now() - start;
+}
 
-[[nodiscard]] static RE::BSGraphics::RenderTargetManager* RenderTargetManager_GetSingleton()
+// FSR transitions its inputs from the state it is told they are in and back again
+static uint32_t GetFFXResourceState(D3D12_RESOURCE_STATES a_state)
 {
-#if defined(FALLOUT_POST_NG)
-	REL::Relocation<RE::BSGraphics::RenderTargetManager*> singleton{ REL::ID(2666735) };
-#else
-	REL::Relocation<RE::BSGraphics::RenderTargetManager*> singleton{ REL::ID(1508457) };
-#endif
-	return singleton.get();
+	switch (a_state) {
+	case D3D12_RESOURCE_STATE_UNORDERED_ACCESS:
+		return FFX_API_RESOURCE_STATE_UNORDERED_ACCESS;
+	case D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE:
+		return FFX_API_RESOURCE_STATE_COMPUTE_READ;
+	case D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE:
+		return FFX_API_RESOURCE_STATE_PIXEL_READ;
+	case D3D12_RESOURCE_STATE_ALL_SHADER_RESOURCE:
+		return FFX_API_RESOURCE_STATE_PIXEL_COMPUTE_READ;
+	case D3D12_RESOURCE_STATE_COPY_SOURCE:
+		return FFX_API_RESOURCE_STATE_COPY_SRC;
+	case D3D12_RESOURCE_STATE_COPY_DEST:
+		return FFX_API_RESOURCE_STATE_COPY_DEST;
+	case D3D12_RESOURCE_STATE_RENDER_TARGET:
+		return FFX_API_RESOURCE_STATE_RENDER_TARGET;
+	default:
+		return FFX_API_RESOURCE_STATE_COMMON;
+	}
 }
 
 void FidelityFX::Present(bool a_useFrameGeneration)
 {
+	ZoneScoped;
+
 	auto upscaling = Upscaling::GetSingleton();
 	auto dx12SwapChain = DX12SwapChain::GetSingleton();
 	auto commandList = dx12SwapChain->commandLists[dx12SwapChain->frameIndex].get();
@@ -69,12 +132,10 @@ void FidelityFX::Present(bool a_useFrameGeneration)
 	if (a_useFrameGeneration) {
 		configParameters.frameGenerationEnabled = true;
 
-		configParameters.frameGenerationCallback = [](ffxDispatchDescFrameGeneration* params, void* pUserCtx) -> ffxReturnCode_t {
-			return ffxModule.Dispatch(reinterpret_cast<ffxContext*>(pUserCtx), &params->header);
-			};
-		configParameters.frameGenerationCallbackUserContext = &frameGenContext;
+		configParameters.frameGenerationCallback = DispatchFrameGeneration;
+		configParameters.frameGenerationCallbackUserContext = this;
 
-		configParameters.HUDLessColor = ffxApiGetResourceDX12(HUDLessColor);
+		configParameters.HUDLessColor = ffxApiGetResourceDX12(HUDLessColor, GetFFXResourceState(dx12SwapChain->stateTracker.GetState(HUDLessColor)));
 
 	}
 	else {
@@ -89,7 +150,6 @@ void FidelityFX::Present(bool a_useFrameGeneration)
 	configParameters.presentCallback = nullptr;
 	configParameters.presentCallbackUserContext = nullptr;
 
-	static uint64_t frameID = 0;
 	configParameters.frameID = frameID;
 	configParameters.swapChain = dx12SwapChain->swapChain;
 	configParameters.onlyPresentGenerated = false;
@@ -130,23 +190,26 @@ void FidelityFX::Present(bool a_useFrameGeneration)
 		dispatchParameters.commandList = commandList;
 
 		static auto gameViewport = State_GetSingleton();
-		static auto renderTargetManager = RenderTargetManager_GetSingleton();
 
 		auto screenSize = float2(float(gameViewport->screenWidth), float(gameViewport->screenHeight));
-		auto renderSize = float2(screenSize.x * renderTargetManager->dynamicWidthRatio, screenSize.y * renderTargetManager->dynamicHeightRatio);
 
-		dispatchParameters.motionVectorScale.x = renderSize.x;
-		dispatchParameters.motionVectorScale.y = renderSize.y;
-		dispatchParameters.renderSize.width = static_cast<uint>(renderSize.x);
-		dispatchParameters.renderSize.height = static_cast<uint>(renderSize.y);
+		// Stored with the slot by the passes that wrote the inputs this frame
+		auto renderSize = upscaling->GetRenderSize();
+
+		// The vectors themselves are scaled by the exact ratio, not the rounded up size
+		dispatchParameters.motionVectorScale.x = screenSize.x * renderSize.widthRatio;
+		dispatchParameters.motionVectorScale.y = screenSize.y * renderSize.heightRatio;
+		dispatchParameters.renderSize.width = renderSize.width;
+		dispatchParameters.renderSize.height = renderSize.height;
 		
 		float2 jitter;
 		jitter.x = -gameViewport->offsetX * screenSize.x / 2.0f;
 		jitter.y = gameViewport->offsetY * screenSize.y / 2.0f;
 
-		dispatchParameters.jitterOffset.x = -jitter.x / renderTargetManager->dynamicWidthRatio;
-		dispatchParameters.jitterOffset.y = -jitter.y / renderTargetManager->dynamicHeightRatio;
+		dispatchParameters.jitterOffset.x = -jitter.x / renderSize.widthRatio;
+		dispatchParameters.jitterOffset.y = -jitter.y / renderSize.heightRatio;
 
+		// Measured, a predicted delta placed generated frames further from the midpoint in every replayed trace
 		dispatchParameters.frameTimeDelta = deltaTime * 1000.f;
 
 #if defined(FALLOUT_POST_NG)
@@ -162,12 +225,45 @@ void FidelityFX::Present(bool a_useFrameGeneration)
 
 		dispatchParameters.frameID = frameID;
 
-		dispatchParameters.depth = ffxApiGetResourceDX12(depth);
-		dispatchParameters.motionVectors = ffxApiGetResourceDX12(motionVectors);
+		auto& stateTracker = dx12SwapChain->stateTracker;
+		auto gpuProfiler = GPUProfiler::GetSingleton();
+
+		// Packed inputs are split into D3D12-only textures first
+		if (upscaling->depthMotionVectorsPacked) {
+			auto unpack = DepthMotionVectorUnpack::GetSingleton();
+
+			gpuProfiler->Begin(GPUProfiler::Pass::kUnpackDepthMotionVectors, commandList);
+			unpack->Dispatch(commandList, dx12SwapChain->frameIndex, renderSize.width, renderSize.height, stateTracker);
+			gpuProfiler->End(GPUProfiler::Pass::kUnpackDepthMotionVectors, commandList);
 
-		if (ffx::Dispatch(frameGenContext, dispatchParameters) != ffx::ReturnCode::Ok) {
-			logger::critical("[FidelityFX] Failed to dispatch frame generation!");
+			depth = unpack->depth[dx12SwapChain->frameIndex].get();
+			motionVectors = unpack->motionVectors[dx12SwapChain->frameIndex].get();
 		}
+
+		// Both prepare inputs become readable in one barrier and return to COMMON for D3D11 in another
+		stateTracker.Transition(depth, D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE);
+		stateTracker.Transition(motionVectors, D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE);
+		stateTracker.Flush(commandList);
+
+		dispatchParameters.depth = ffxApiGetResourceDX12(depth, GetFFXResourceState(stateTracker.GetState(depth)));
+		dispatchParameters.motionVectors = ffxApiGetResourceDX12(motionVectors, GetFFXResourceState(stateTracker.GetState(motionVectors)));
+
+		Telemetry::GetSingleton()->Mark(Telemetry::Event::kFrameGenerationDispatch);
+
+		gpuProfiler->Begin(GPUProfiler::Pass::kFrameGenerationPrepare, commandList);
+
+		{
+			ZoneScopedN("DispatchDescFrameGenerationPrepare");
+			if (ffx::Dispatch(frameGenContext, dispatchParameters) != ffx::ReturnCode::Ok) {
+				logger::critical("[FidelityFX] Failed to dispatch frame generation!");
+			}
+		}
+
+		gpuProfiler->End(GPUProfiler::Pass::kFrameGenerationPrepare, commandList);
+
+		stateTracker.Transition(depth, D3D12_RESOURCE_STATE_COMMON);
+		stateTracker.Transition(motionVectors, D3D12_RESOURCE_STATE_COMMON);
+		stateTracker.Flush(commandList);
 	}
 
 	frameID++;
@@ -22,7 +22,18 @@ public:
 	ffx::Context swapChainContext{};
 	ffx::Context frameGenContext;
 
+	// Incremented by exactly one every presented frame, as FSR requires
+	uint64_t frameID = 0;
+
+	// FSR's async interpolation queue reads the slot's inputs after the game queue has moved on, the interpolation
+	// command list writes frameID + 1 here once everything recorded before it has finished
+	winrt::com_ptr<ID3D12Resource> interpolationMarker;
+	volatile uint32_t* interpolationMarkerData = nullptr;
+
 	void LoadFFX();
 	void SetupFrameGeneration();
 	void Present(bool a_useFrameGeneration);
+
+	// Blocks until the interpolation of the frame has finished on the GPU, returns the QPC ticks spent waiting
+	int64_t WaitForInterpolation(uint64_t a_frameID);
 };
@@ -0,0 +1,147 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+
+// Frame pacing shared by the plugin limiters and the pacing simulator
+class FramePacer
+{
+public:
+	// Stick within VRR bounds
+	static double GetVRRTargetRate(double a_refreshRate)
+	{
+		return a_refreshRate - (a_refreshRate * a_refreshRate) / 3600.0;
+	}
+
+	// Real frame interval, frame generation presents twice per real frame
+	static int64_t GetTargetInterval(int64_t a_frequency, double a_targetRate, bool a_useFrameGeneration)
+	{
+		return int64_t(double(a_frequency) / (a_targetRate * (a_useFrameGeneration ? 0.5 : 1.0)));
+	}
+
+	// Sleeps until a_interval ticks have passed since the previous call, returns the ticks slept
+	template <class Clock, class SleepFunc>
+	int64_t Limit(Clock& a_clock, int64_t a_interval, SleepFunc&& a_sleep)
+	{
+		int64_t timeNow = a_clock.Now();
+		if (a_interval > 0 && timeNow - lastFrame < a_interval)
+			a_sleep(lastFrame + a_interval);
+
+		lastFrame = a_clock.Now();
+		return lastFrame - timeNow;
+	}
+
+	int64_t lastFrame = 0;
+};
+
+// Closed-loop replacement for the fixed VRR safety margin, driven by measured present statistics.
+// Frame time jitter pins single presents to the refresh ceiling even when the average rate is inside
+// the VRR window, so presents are judged in samples whose mean interval cancels the jitter out. The
+// margin follows a percentile of the pinned fraction over recent windows and moves by the same step
+// in both directions, so it settles instead of ratcheting up.
+class VRRMarginController
+{
+public:
+	static constexpr double kMinMargin = 0.005;
+	static constexpr double kMaxMargin = 0.1;
+	static constexpr double kStep = 0.0025;
+	static constexpr double kCeilingTolerance = 0.0025;
+
+	// Presents averaged per sample, samples per window and windows the percentile is taken over
+	static constexpr uint32_t kSamplePresents = 8;
+	static constexpr uint32_t kWindowSamples = 8;
+	static constexpr uint32_t kWindowCount = 8;
+	static constexpr double kPercentile = 0.75;
+
+	// Dead band of the pinned fraction, the margin holds between the two
+	static constexpr double kRaiseFraction = 0.25;
+	static constexpr double kLowerFraction = 0.125;
+
+	// Starts from the same margin as GetVRRTargetRate
+	void SetRefreshRate(double a_refreshRate)
+	{
+		if (a_refreshRate == refreshRate)
+			return;
+
+		refreshRate = a_refreshRate;
+		margin = std::clamp(refreshRate / 3600.0, kMinMargin, kMaxMargin);
+
+		samplePresents = 0;
+		sampleTicks = 0;
+		windowSamples = 0;
+		windowPinned = 0;
+		windowCount = 0;
+	}
+
+	double GetTargetRate() const
+	{
+		return refreshRate * (1.0 - margin);
+	}
+
+	// a_presents frames reached the display over a_displayTicks, a_refreshTicks is the fastest refresh interval
+	bool Update(uint32_t a_presents, int64_t a_displayTicks, int64_t a_refreshTicks)
+	{
+		if (!a_presents || a_displayTicks <= 0)
+			return false;
+
+		samplePresents += a_presents;
+		sampleTicks += a_displayTicks;
+		if (samplePresents < kSamplePresents)
+			return false;
+
+		// The display held the whole sample at its fastest refresh, the frame rate has left the VRR window
+		double interval = double(sampleTicks) / double(samplePresents);
+		if (interval < double(a_refreshTicks) * (1.0 + kCeilingTolerance))
+			windowPinned++;
+
+		samplePresents = 0;
+		sampleTicks = 0;
+
+		if (++windowSamples < kWindowSamples)
+			return false;
+
+		fractions[windowIndex] = double(windowPinned) / double(windowSamples);
+		windowIndex = (windowIndex + 1) % kWindowCount;
+		windowCount = std::min(windowCount + 1, kWindowCount);
+		windowSamples = 0;
+		windowPinned = 0;
+
+		if (windowCount < kWindowCount)
+			return false;
+
+		double pinned = GetPinnedFraction();
+		double previous = margin;
+
+		if (pinned > kRaiseFraction)
+			margin = std::min(kMaxMargin, margin + kStep);
+		else if (pinned < kLowerFraction)
+			margin = std::max(kMinMargin, margin - kStep);
+
+		return margin != previous;
+	}
+
+	// kPercentile of the pinned fraction over the last kWindowCount windows
+	double GetPinnedFraction() const
+	{
+		if (!windowCount)
+			return 0.0;
+
+		double sorted[kWindowCount];
+		std::copy_n(fractions, windowCount, sorted);
+		std::sort(sorted, sorted + windowCount);
+		return sorted[std::min(windowCount - 1, uint32_t(kPercentile * double(windowCount)))];
+	}
+
+	double refreshRate = 0.0;
+	double margin = 0.0;
+
+private:
+	uint32_t samplePresents = 0;
+	int64_t sampleTicks = 0;
+
+	double fractions[kWindowCount]{};
+	uint32_t windowIndex = 0;
+	uint32_t windowCount = 0;
+	uint32_t windowSamples = 0;
+	uint32_t windowPinned = 0;
+};
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+
+// Per-frame resources are kept in slots indexed by the back buffer index. D3D12 retires a slot once
+// everything reading it has been submitted, D3D11 must wait for that value before writing the slot again
+class FrameRing
+{
+public:
+	static constexpr uint32_t kMinDepth = 2;
+	static constexpr uint32_t kMaxDepth = 4;
+
+	struct WaitStats
+	{
+		uint64_t frames = 0;
+		uint64_t waits = 0;
+		int64_t totalTicks = 0;
+		int64_t maxTicks = 0;
+
+		void Add(int64_t a_ticks)
+		{
+			frames++;
+			if (a_ticks > 0) {
+				waits++;
+				totalTicks += a_ticks;
+				maxTicks = std::max(maxTicks, a_ticks);
+			}
+		}
+	};
+
+	void SetDepth(uint32_t a_depth) { depth = std::clamp(a_depth, kMinDepth, kMaxDepth); }
+	uint32_t GetDepth() const { return depth; }
+
+	void SetMaxFramesAhead(uint32_t a_frames) { maxFramesAhead = std::clamp(a_frames, 1u, depth); }
+	uint32_t GetMaxFramesAhead() const { return maxFramesAhead; }
+
+	// Returns the completion fence value to signal after the slot's last reader
+	uint64_t Retire(uint32_t a_slot)
+	{
+		retireValues[a_slot] = ++timeline;
+		return timeline;
+	}
+
+	// Completion fence value that must be reached before the slot is written
+	uint64_t GetReuseValue(uint32_t a_slot) const { return retireValues[a_slot]; }
+
+	uint64_t GetTimeline() const { return timeline; }
+
+	// Completion fence value that keeps no more than maxFramesAhead retired frames in flight
+	uint64_t GetFramesAheadValue() const { return timeline > maxFramesAhead ? timeline - maxFramesAhead : 0; }
+
+private:
+	uint32_t depth = kMinDepth;
+	uint32_t maxFramesAhead = 1;
+	uint64_t timeline = 0;
+	uint64_t retireValues[kMaxDepth]{};
+};
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+
+// Smoothed frame time with outlier rejection, platform independent so it can be run against recorded traces.
+// Only FramePacingSimulator --predictive uses it, the plugin paces with measured frame times until a
+// predictor beats them in the replay checks.
+class FrameTimePredictor
+{
+public:
+	static constexpr size_t kHistorySize = 16;
+	static constexpr double kOutlierRatio = 1.75;
+	static constexpr double kSmoothing = 0.15;
+
+	// Returns false if the sample was rejected as an outlier
+	bool AddSample(double a_frameTime)
+	{
+		if (a_frameTime <= 0.0)
+			return false;
+
+		// Every sample enters the history so the median follows sustained changes
+		history[historyIndex] = a_frameTime;
+		historyIndex = (historyIndex + 1) % kHistorySize;
+		historyCount = std::min(historyCount + 1, kHistorySize);
+
+		if (prediction <= 0.0) {
+			prediction = a_frameTime;
+			return true;
+		}
+
+		double median = GetMedian();
+		if (a_frameTime > median * kOutlierRatio || a_frameTime < median / kOutlierRatio)
+			return false;
+
+		prediction += (a_frameTime - prediction) * kSmoothing;
+		return true;
+	}
+
+	double GetPrediction() const { return prediction; }
+
+	void Reset()
+	{
+		historyIndex = 0;
+		historyCount = 0;
+		prediction = 0.0;
+	}
+
+private:
+	double GetMedian() const
+	{
+		std::array<double, kHistorySize> sorted{};
+		std::copy_n(history.begin(), historyCount, sorted.begin());
+		std::nth_element(sorted.begin(), sorted.begin() + historyCount / 2, sorted.begin() + historyCount);
+		return sorted[historyCount / 2];
+	}
+
+	std::array<double, kHistorySize> history{};
+	size_t historyIndex = 0;
+	size_t historyCount = 0;
+	double prediction = 0.0;
+};
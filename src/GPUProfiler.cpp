@@ -0,0 +1,382 @@
+#include "GPUProfiler.h"
+
+#include "Telemetry.h"
+#include "Upscaling.h"
+
+void GPUProfiler::Initialize(ID3D11Device* a_d3d11Device, ID3D11DeviceContext* a_d3d11Context, ID3D12Device* a_d3d12Device, ID3D12CommandQueue* a_commandQueue, ID3D12CommandQueue* a_transferQueue)
+{
+	d3d11Device.copy_from(a_d3d11Device);
+	d3d11Context.copy_from(a_d3d11Context);
+	commandQueue.copy_from(a_commandQueue);
+
+	D3D11_QUERY_DESC disjointDesc{ D3D11_QUERY_TIMESTAMP_DISJOINT, 0 };
+	D3D11_QUERY_DESC timestampDesc{ D3D11_QUERY_TIMESTAMP, 0 };
+	D3D11_QUERY_DESC eventDesc{ D3D11_QUERY_EVENT, 0 };
+
+	DX::ThrowIfFailed(d3d11Device->CreateQuery(&eventDesc, calibrationIdle11.put()));
+	DX::ThrowIfFailed(d3d11Device->CreateQuery(&timestampDesc, calibrationTimestamp11.put()));
+
+	for (auto& queries : queries11) {
+		DX::ThrowIfFailed(d3d11Device->CreateQuery(&disjointDesc, queries.disjoint.put()));
+		for (uint32_t i = 0; i < kFirstPass12; i++) {
+			DX::ThrowIfFailed(d3d11Device->CreateQuery(&timestampDesc, queries.begin[i].put()));
+			DX::ThrowIfFailed(d3d11Device->CreateQuery(&timestampDesc, queries.end[i].put()));
+		}
+	}
+
+	D3D12_QUERY_HEAP_DESC queryHeapDesc{};
+	queryHeapDesc.Type = D3D12_QUERY_HEAP_TYPE_TIMESTAMP;
+	queryHeapDesc.Count = kQueryCount12;
+	DX::ThrowIfFailed(a_d3d12Device->CreateQueryHeap(&queryHeapDesc, IID_PPV_ARGS(&queryHeap)));
+
+	if (a_transferQueue) {
+		// Copy queues need their own heap type, which not every driver supports
+		bool copyQueue = a_transferQueue->GetDesc().Type == D3D12_COMMAND_LIST_TYPE_COPY;
+
+		D3D12_FEATURE_DATA_D3D12_OPTIONS3 options3{};
+		if (!copyQueue || (SUCCEEDED(a_d3d12Device->CheckFeatureSupport(D3D12_FEATURE_D3D12_OPTIONS3, &options3, sizeof(options3))) && options3.CopyQueueTimestampQueriesSupported)) {
+			queryHeapDesc.Type = copyQueue ? D3D12_QUERY_HEAP_TYPE_COPY_QUEUE_TIMESTAMP : D3D12_QUERY_HEAP_TYPE_TIMESTAMP;
+			queryHeapDesc.Count = kTransferQueryCount;
+			DX::ThrowIfFailed(a_d3d12Device->CreateQueryHeap(&queryHeapDesc, IID_PPV_ARGS(&transferQueryHeap)));
+			DX::ThrowIfFailed(a_transferQueue->GetTimestampFrequency(&transferFrequency));
+			transferQueue.copy_from(a_transferQueue);
+		} else {
+			logger::warn("[GPU Profiler] Copy queue timestamps are not supported, the transfer queue is not measured");
+		}
+	}
+
+	auto heapProperties = CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_READBACK);
+	auto bufferDesc = CD3DX12_RESOURCE_DESC::Buffer((kQueryCount12 + kTransferQueryCount) * sizeof(uint64_t));
+	DX::ThrowIfFailed(a_d3d12Device->CreateCommittedResource(&heapProperties, D3D12_HEAP_FLAG_NONE, &bufferDesc, D3D12_RESOURCE_STATE_COPY_DEST, nullptr, IID_PPV_ARGS(&readbackBuffer)));
+
+	DX::ThrowIfFailed(a_d3d12Device->CreateFence(0, D3D12_FENCE_FLAG_NONE, IID_PPV_ARGS(&fence)));
+	DX::ThrowIfFailed(commandQueue->GetTimestampFrequency(&frequency12));
+
+	Calibrate11();
+
+	d3d11Context->Begin(queries11[0].disjoint.get());
+
+	enabled = true;
+
+	logger::info("[GPU Profiler] Enabled");
+}
+
+void GPUProfiler::Calibrate11()
+{
+	auto& clock = Upscaling::GetSingleton()->clock;
+
+	// Drain the GPU first so the timestamp executes as soon as it is submitted
+	d3d11Context->End(calibrationIdle11.get());
+	BOOL done = FALSE;
+	while (d3d11Context->GetData(calibrationIdle11.get(), &done, sizeof(done), 0) != S_OK)
+		YieldProcessor();
+
+	int64_t submitStart = clock.Now();
+	d3d11Context->End(calibrationTimestamp11.get());
+	d3d11Context->Flush();
+	int64_t submitEnd = clock.Now();
+
+	while (d3d11Context->GetData(calibrationTimestamp11.get(), &calibrationGPU11, sizeof(calibrationGPU11), 0) != S_OK)
+		YieldProcessor();
+
+	calibrationCPU11 = submitStart + (submitEnd - submitStart) / 2;
+	calibrationFrame11 = frame11;
+	disjoint11 = false;
+}
+
+void GPUProfiler::Begin(Pass a_pass)
+{
+	if (!enabled)
+		return;
+
+	auto& queries = queries11[frame11 % kFrameSlots];
+	d3d11Context->End(queries.begin[(uint32_t)a_pass].get());
+}
+
+void GPUProfiler::End(Pass a_pass)
+{
+	if (!enabled)
+		return;
+
+	auto& queries = queries11[frame11 % kFrameSlots];
+	d3d11Context->End(queries.end[(uint32_t)a_pass].get());
+	queries.passMask |= 1 << (uint32_t)a_pass;
+}
+
+void GPUProfiler::Begin(Pass a_pass, ID3D12GraphicsCommandList* a_commandList)
+{
+	if (!enabled)
+		return;
+
+	a_commandList->EndQuery(queryHeap.get(), D3D12_QUERY_TYPE_TIMESTAMP, GetQueryIndex(a_pass, (uint32_t)(frame12 % kFrameSlots)));
+}
+
+void GPUProfiler::End(Pass a_pass, ID3D12GraphicsCommandList* a_commandList)
+{
+	if (!enabled)
+		return;
+
+	a_commandList->EndQuery(queryHeap.get(), D3D12_QUERY_TYPE_TIMESTAMP, GetQueryIndex(a_pass, (uint32_t)(frame12 % kFrameSlots)) + 1);
+	passMask12[frame12 % kFrameSlots] |= 1 << ((uint32_t)a_pass - kFirstPass12);
+}
+
+void GPUProfiler::BeginStatic(Pass a_pass, uint32_t a_ringSlot, ID3D12GraphicsCommandList* a_commandList)
+{
+	if (!enabled)
+		return;
+
+	a_commandList->EndQuery(queryHeap.get(), D3D12_QUERY_TYPE_TIMESTAMP, GetStaticQueryIndex(a_pass, a_ringSlot));
+}
+
+void GPUProfiler::EndStatic(Pass a_pass, uint32_t a_ringSlot, ID3D12GraphicsCommandList* a_commandList)
+{
+	if (!enabled)
+		return;
+
+	a_commandList->EndQuery(queryHeap.get(), D3D12_QUERY_TYPE_TIMESTAMP, GetStaticQueryIndex(a_pass, a_ringSlot) + 1);
+}
+
+void GPUProfiler::UseStatic(Pass a_pass, uint32_t a_ringSlot)
+{
+	if (!enabled)
+		return;
+
+	uint32_t frameSlot = (uint32_t)(frame12 % kFrameSlots);
+	uint32_t pass = (uint32_t)a_pass - kFirstPass12;
+	passMask12[frameSlot] |= 1 << pass;
+	staticMask12[frameSlot] |= 1 << pass;
+	staticRingSlots[frameSlot][pass] = a_ringSlot;
+}
+
+void GPUProfiler::BeginTransfer(Pass a_pass, uint32_t a_ringSlot, ID3D12GraphicsCommandList* a_commandList)
+{
+	if (!enabled || !transferQueryHeap)
+		return;
+
+	a_commandList->EndQuery(transferQueryHeap.get(), D3D12_QUERY_TYPE_TIMESTAMP, GetTransferQueryIndex(a_pass, a_ringSlot));
+}
+
+void GPUProfiler::EndTransfer(Pass a_pass, uint32_t a_ringSlot, ID3D12GraphicsCommandList* a_commandList)
+{
+	if (!enabled || !transferQueryHeap)
+		return;
+
+	uint32_t index = GetTransferQueryIndex(a_pass, a_ringSlot);
+	a_commandList->EndQuery(transferQueryHeap.get(), D3D12_QUERY_TYPE_TIMESTAMP, index + 1);
+
+	// Resolved on the transfer queue itself, the game queue would have to wait for it first
+	a_commandList->ResolveQueryData(transferQueryHeap.get(), D3D12_QUERY_TYPE_TIMESTAMP, index, 2, readbackBuffer.get(), (kQueryCount12 + index) * sizeof(uint64_t));
+}
+
+void GPUProfiler::UseTransfer(Pass a_pass, uint32_t a_ringSlot)
+{
+	if (!enabled || !transferQueryHeap)
+		return;
+
+	uint32_t frameSlot = (uint32_t)(frame12 % kFrameSlots);
+	uint32_t pass = (uint32_t)a_pass - kFirstPass12;
+	transferMask12[frameSlot] |= 1 << pass;
+	staticRingSlots[frameSlot][pass] = a_ringSlot;
+}
+
+void GPUProfiler::EndFrame11()
+{
+	if (!enabled)
+		return;
+
+	d3d11Context->End(queries11[frame11 % kFrameSlots].disjoint.get());
+	frame11++;
+
+	Collect11();
+
+	// Results that never became ready in time are dropped rather than waited on
+	if (frame11 - collected11 >= kFrameSlots)
+		collected11 = frame11 - kFrameSlots + 1;
+
+	// Between the frame brackets, so the drain is not inside any measured frame
+	if (disjoint11 || frame11 - calibrationFrame11 >= kCalibrationInterval11)
+		Calibrate11();
+
+	auto& queries = queries11[frame11 % kFrameSlots];
+	queries.passMask = 0;
+	d3d11Context->Begin(queries.disjoint.get());
+}
+
+void GPUProfiler::Collect11()
+{
+	double qpcFrequency = double(Upscaling::GetSingleton()->clock.Frequency());
+
+	for (; collected11 < frame11; collected11++) {
+		auto& queries = queries11[collected11 % kFrameSlots];
+
+		D3D11_QUERY_DATA_TIMESTAMP_DISJOINT disjoint{};
+		if (d3d11Context->GetData(queries.disjoint.get(), &disjoint, sizeof(disjoint), D3D11_ASYNC_GETDATA_DONOTFLUSH) != S_OK)
+			break;
+
+		// The counter may have been reset or changed frequency, the anchor no longer holds
+		if (disjoint.Disjoint) {
+			disjoint11 = true;
+			continue;
+		}
+
+		auto ToQPC = [&](uint64_t a_timestamp) {
+			return calibrationCPU11 + int64_t(double(int64_t(a_timestamp - calibrationGPU11)) * qpcFrequency / double(disjoint.Frequency));
+		};
+
+		for (uint32_t i = 0; i < kFirstPass12; i++) {
+			if (!(queries.passMask & (1 << i)))
+				continue;
+
+			uint64_t begin = 0;
+			uint64_t end = 0;
+			if (d3d11Context->GetData(queries.begin[i].get(), &begin, sizeof(begin), D3D11_ASYNC_GETDATA_DONOTFLUSH) != S_OK ||
+				d3d11Context->GetData(queries.end[i].get(), &end, sizeof(end), D3D11_ASYNC_GETDATA_DONOTFLUSH) != S_OK)
+				continue;
+
+			AddResult((Pass)i, collected11, ToQPC(begin), ToQPC(end));
+		}
+	}
+}
+
+void GPUProfiler::ResolveFrame12(ID3D12GraphicsCommandList* a_commandList)
+{
+	if (!enabled)
+		return;
+
+	uint32_t slot = (uint32_t)(frame12 % kFrameSlots);
+	for (uint32_t i = 0; i < kPassCount12; i++) {
+		if (!(passMask12[slot] & (1 << i)))
+			continue;
+
+		Pass pass = (Pass)(kFirstPass12 + i);
+		uint32_t index = GetQueryIndex(pass, slot);
+
+		// Pre-recorded queries land in the frame's readback range like the others
+		uint32_t sourceIndex = staticMask12[slot] & (1 << i) ? GetStaticQueryIndex(pass, staticRingSlots[slot][i]) : index;
+		a_commandList->ResolveQueryData(queryHeap.get(), D3D12_QUERY_TYPE_TIMESTAMP, sourceIndex, 2, readbackBuffer.get(), index * sizeof(uint64_t));
+	}
+}
+
+void GPUProfiler::EndFrame12()
+{
+	if (!enabled)
+		return;
+
+	DX::ThrowIfFailed(commandQueue->Signal(fence.get(), frame12 + 1));
+	frame12++;
+
+	Collect12();
+
+	if (frame12 - collected12 >= kFrameSlots)
+		collected12 = frame12 - kFrameSlots + 1;
+
+	passMask12[frame12 % kFrameSlots] = 0;
+	staticMask12[frame12 % kFrameSlots] = 0;
+	transferMask12[frame12 % kFrameSlots] = 0;
+
+	if (collectedFrames >= 1000) {
+		std::string message;
+		for (uint32_t i = 0; i < kPassCount; i++)
+			message += std::format(" {} {:.3f} ms", magic_enum::enum_name((Pass)i).substr(1), averageTime[i]);
+
+		logger::info("[GPU Profiler]{}", message);
+
+		// Compare these between iTransferQueue settings, the span is what the copy adds before the present
+		if (transferQueue)
+			logger::info("[GPU Profiler] D3D12 game queue {:.3f} ms, {} queue {:.3f} ms, span {:.3f} ms", averageGameQueueTime,
+				transferQueue->GetDesc().Type == D3D12_COMMAND_LIST_TYPE_COPY ? "copy" : "compute", averageTransferQueueTime, averageSpan12);
+		else
+			logger::info("[GPU Profiler] D3D12 game queue {:.3f} ms, span {:.3f} ms", averageGameQueueTime, averageSpan12);
+
+		collectedFrames = 0;
+	}
+}
+
+void GPUProfiler::Collect12()
+{
+	uint64_t completedValue = fence->GetCompletedValue();
+	if (collected12 >= completedValue)
+		return;
+
+	// Recalibrate every time so drift between the GPU and CPU clocks never accumulates
+	uint64_t calibrationGPU = 0;
+	uint64_t calibrationCPU = 0;
+	if (FAILED(commandQueue->GetClockCalibration(&calibrationGPU, &calibrationCPU)))
+		return;
+
+	double qpcFrequency = double(Upscaling::GetSingleton()->clock.Frequency());
+
+	auto ToQPC = [&](uint64_t a_timestamp) {
+		return int64_t(calibrationCPU) + int64_t(double(int64_t(a_timestamp - calibrationGPU)) * qpcFrequency / double(frequency12));
+	};
+
+	// Each queue has its own timestamp clock
+	uint64_t transferCalibrationGPU = 0;
+	uint64_t transferCalibrationCPU = 0;
+	if (transferQueue && FAILED(transferQueue->GetClockCalibration(&transferCalibrationGPU, &transferCalibrationCPU)))
+		return;
+
+	auto TransferToQPC = [&](uint64_t a_timestamp) {
+		return int64_t(transferCalibrationCPU) + int64_t(double(int64_t(a_timestamp - transferCalibrationGPU)) * qpcFrequency / double(transferFrequency));
+	};
+
+	for (; collected12 < frame12 && collected12 < completedValue; collected12++) {
+		uint32_t slot = (uint32_t)(collected12 % kFrameSlots);
+		uint32_t first = slot * kPassCount12 * 2;
+
+		D3D12_RANGE readRange{ 0, (kQueryCount12 + kTransferQueryCount) * sizeof(uint64_t) };
+		uint64_t* timestamps = nullptr;
+		DX::ThrowIfFailed(readbackBuffer->Map(0, &readRange, reinterpret_cast<void**>(&timestamps)));
+
+		int64_t gameQueueTicks = 0;
+		int64_t transferQueueTicks = 0;
+		int64_t spanBegin = INT64_MAX;
+		int64_t spanEnd = INT64_MIN;
+
+		for (uint32_t i = 0; i < kPassCount12; i++) {
+			if (passMask12[slot] & (1 << i)) {
+				int64_t begin = ToQPC(timestamps[first + i * 2]);
+				int64_t end = ToQPC(timestamps[first + i * 2 + 1]);
+				AddResult((Pass)(kFirstPass12 + i), collected12, begin, end);
+
+				gameQueueTicks += end - begin;
+				spanBegin = std::min(spanBegin, begin);
+				spanEnd = std::max(spanEnd, end);
+			}
+
+			// The slot's range is only rewritten once the ring comes back around to it
+			if (transferMask12[slot] & (1 << i)) {
+				uint32_t index = kQueryCount12 + GetTransferQueryIndex((Pass)(kFirstPass12 + i), staticRingSlots[slot][i]);
+				int64_t begin = TransferToQPC(timestamps[index]);
+				int64_t end = TransferToQPC(timestamps[index + 1]);
+				AddResult((Pass)(kFirstPass12 + i), collected12, begin, end);
+
+				transferQueueTicks += end - begin;
+				spanBegin = std::min(spanBegin, begin);
+				spanEnd = std::max(spanEnd, end);
+			}
+		}
+
+		if (spanEnd > spanBegin) {
+			double ticksToMs = 1000.0 / qpcFrequency;
+			averageGameQueueTime += (double(gameQueueTicks) * ticksToMs - averageGameQueueTime) * 0.05;
+			averageTransferQueueTime += (double(transferQueueTicks) * ticksToMs - averageTransferQueueTime) * 0.05;
+			averageSpan12 += (double(spanEnd - spanBegin) * ticksToMs - averageSpan12) * 0.05;
+		}
+
+		D3D12_RANGE writeRange{ 0, 0 };
+		readbackBuffer->Unmap(0, &writeRange);
+
+		collectedFrames++;
+	}
+}
+
+void GPUProfiler::AddResult(Pass a_pass, uint64_t a_frame, int64_t a_begin, int64_t a_end)
+{
+	double time = double(a_end - a_begin) * 1000.0 / double(Upscaling::GetSingleton()->clock.Frequency());
+
+	auto& average = averageTime[(uint32_t)a_pass];
+	average += (time - average) * 0.05;
+
+	Telemetry::GetSingleton()->AddGPUPass(a_pass, a_frame, a_begin, a_end);
+}
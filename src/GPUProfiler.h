@@ -0,0 +1,147 @@
+#pragma once
+
+#include <winrt/base.h>
+
+#include <d3d11_4.h>
+#include <d3d12.h>
+
+#include "FrameRing.h"
+
+// GPU timestamps around the plugin's own D3D11 and D3D12 work, read back a few frames late
+// without stalling and converted to QPC ticks so both queues share the CPU timeline
+class GPUProfiler
+{
+public:
+	static GPUProfiler* GetSingleton()
+	{
+		static GPUProfiler singleton;
+		return &singleton;
+	}
+
+	enum class Pass : uint32_t
+	{
+		// D3D11 immediate context
+		kReset,
+		kPreAlpha,
+		kGenerateSharedBuffers,
+		kSnapshotColor,
+		kClassifyAlphaTiles,
+		kMaskAlphaTiles,
+		kCopyMotionVectors,
+		kCopyDepth,
+		kCopyDepthMotionVectors,
+		kCopyHUDLess,
+		kCopyProxy,
+
+		// D3D12 game queue
+		kCopySwapChain,
+		kUnpackDepthMotionVectors,
+		kFrameGenerationPrepare,
+
+		kCount
+	};
+
+	static constexpr uint32_t kFirstPass12 = (uint32_t)Pass::kCopySwapChain;
+	static constexpr uint32_t kPassCount = (uint32_t)Pass::kCount;
+	static constexpr uint32_t kPassCount12 = kPassCount - kFirstPass12;
+
+	// Frames in flight before a query slot is reused
+	static constexpr uint32_t kFrameSlots = 4;
+
+	struct FrameQueries11
+	{
+		winrt::com_ptr<ID3D11Query> disjoint;
+		winrt::com_ptr<ID3D11Query> begin[kFirstPass12];
+		winrt::com_ptr<ID3D11Query> end[kFirstPass12];
+		uint32_t passMask = 0;
+	};
+
+	bool enabled = false;
+
+	// Moving averages in milliseconds
+	double averageTime[kPassCount]{};
+
+	// Per D3D12 frame, the time each queue spent in the plugin's passes and the span from the first
+	// begin to the last end on either queue, which shows whether the transfer queue overlapped anything
+	double averageGameQueueTime = 0.0;
+	double averageTransferQueueTime = 0.0;
+	double averageSpan12 = 0.0;
+
+	void Initialize(ID3D11Device* a_d3d11Device, ID3D11DeviceContext* a_d3d11Context, ID3D12Device* a_d3d12Device, ID3D12CommandQueue* a_commandQueue, ID3D12CommandQueue* a_transferQueue);
+
+	void Begin(Pass a_pass);
+	void End(Pass a_pass);
+
+	void Begin(Pass a_pass, ID3D12GraphicsCommandList* a_commandList);
+	void End(Pass a_pass, ID3D12GraphicsCommandList* a_commandList);
+
+	// Queries recorded once into a pre-built command list of a frame ring slot, UseStatic reads them back for the current frame
+	void BeginStatic(Pass a_pass, uint32_t a_ringSlot, ID3D12GraphicsCommandList* a_commandList);
+	void EndStatic(Pass a_pass, uint32_t a_ringSlot, ID3D12GraphicsCommandList* a_commandList);
+	void UseStatic(Pass a_pass, uint32_t a_ringSlot);
+
+	// Same for lists replayed on the transfer queue, which has its own timestamp heap and clock and resolves its own queries
+	void BeginTransfer(Pass a_pass, uint32_t a_ringSlot, ID3D12GraphicsCommandList* a_commandList);
+	void EndTransfer(Pass a_pass, uint32_t a_ringSlot, ID3D12GraphicsCommandList* a_commandList);
+	void UseTransfer(Pass a_pass, uint32_t a_ringSlot);
+
+	// Called around the shared fence signal, closes the D3D11 frame and opens the next
+	void EndFrame11();
+
+	// Called before the command list is closed and after it is executed
+	void ResolveFrame12(ID3D12GraphicsCommandList* a_commandList);
+	void EndFrame12();
+
+private:
+	void Calibrate11();
+	void Collect11();
+	void Collect12();
+
+	void AddResult(Pass a_pass, uint64_t a_frame, int64_t a_begin, int64_t a_end);
+
+	static uint32_t GetQueryIndex(Pass a_pass, uint32_t a_frameSlot) { return (a_frameSlot * kPassCount12 + ((uint32_t)a_pass - kFirstPass12)) * 2; }
+	static uint32_t GetStaticQueryIndex(Pass a_pass, uint32_t a_ringSlot) { return (kFrameSlots * kPassCount12 + a_ringSlot * kPassCount12 + ((uint32_t)a_pass - kFirstPass12)) * 2; }
+	static uint32_t GetTransferQueryIndex(Pass a_pass, uint32_t a_ringSlot) { return (a_ringSlot * kPassCount12 + ((uint32_t)a_pass - kFirstPass12)) * 2; }
+
+	// Transfer results follow the game queue's in the readback buffer
+	static constexpr uint32_t kQueryCount12 = (kFrameSlots + FrameRing::kMaxDepth) * kPassCount12 * 2;
+	static constexpr uint32_t kTransferQueryCount = FrameRing::kMaxDepth * kPassCount12 * 2;
+
+	winrt::com_ptr<ID3D11Device> d3d11Device;
+	winrt::com_ptr<ID3D11DeviceContext> d3d11Context;
+
+	FrameQueries11 queries11[kFrameSlots];
+	uint64_t frame11 = 0;
+	uint64_t collected11 = 0;
+
+	// D3D11 has no clock calibration, a timestamp taken on an idle GPU is matched to the QPC at submission.
+	// That drains the GPU, so it is repeated every kCalibrationInterval11 frames and after a disjoint frame
+	// rather than on every collect like D3D12
+	static constexpr uint64_t kCalibrationInterval11 = 600;
+
+	winrt::com_ptr<ID3D11Query> calibrationIdle11;
+	winrt::com_ptr<ID3D11Query> calibrationTimestamp11;
+	uint64_t calibrationGPU11 = 0;
+	int64_t calibrationCPU11 = 0;
+	uint64_t calibrationFrame11 = 0;
+	bool disjoint11 = false;
+
+	winrt::com_ptr<ID3D12CommandQueue> commandQueue;
+	winrt::com_ptr<ID3D12QueryHeap> queryHeap;
+	winrt::com_ptr<ID3D12Resource> readbackBuffer;
+	winrt::com_ptr<ID3D12Fence> fence;
+	uint64_t frequency12 = 0;
+
+	winrt::com_ptr<ID3D12CommandQueue> transferQueue;
+	winrt::com_ptr<ID3D12QueryHeap> transferQueryHeap;
+	uint64_t transferFrequency = 0;
+
+	uint32_t passMask12[kFrameSlots]{};
+	uint32_t transferMask12[kFrameSlots]{};
+	uint32_t staticMask12[kFrameSlots]{};
+	uint32_t staticRingSlots[kFrameSlots][kPassCount12]{};
+	uint64_t frame12 = 0;
+	uint64_t collected12 = 0;
+
+	uint64_t collectedFrames = 0;
+};
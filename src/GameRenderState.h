@@ -0,0 +1,23 @@
+#pragma once
+
+// Game renderer singletons CommonLibF4 has no accessor for
+
+[[nodiscard]] inline RE::BSGraphics::State* State_GetSingleton()
+{
+#if defined(FALLOUT_POST_NG)
+	REL::Relocation<RE::BSGraphics::State*> singleton{ REL::ID(2704621) };
+#else
+	REL::Relocation<RE::BSGraphics::State*> singleton{ REL::ID(600795) };
+#endif
+	return singleton.get();
+}
+
+[[nodiscard]] inline RE::BSGraphics::RenderTargetManager* RenderTargetManager_GetSingleton()
+{
+#if defined(FALLOUT_POST_NG)
+	REL::Relocation<RE::BSGraphics::RenderTargetManager*> singleton{ REL::ID(2666735) };
+#else
+	REL::Relocation<RE::BSGraphics::RenderTargetManager*> singleton{ REL::ID(1508457) };
+#endif
+	return singleton.get();
+}
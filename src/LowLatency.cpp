@@ -0,0 +1,156 @@
+#include "LowLatency.h"
+
+#include "DX12SwapChain.h"
+#include "Upscaling.h"
+
+void LowLatency::CreateFence(ID3D12Device* a_device)
+{
+	DX::ThrowIfFailed(a_device->CreateFence(0, D3D12_FENCE_FLAG_NONE, IID_PPV_ARGS(&fence)));
+	fenceEvent = CreateEvent(nullptr, FALSE, FALSE, nullptr);
+
+	tracking = true;
+	completionThread = std::jthread([this](std::stop_token a_stopToken) { WaitForCompletions(a_stopToken); });
+}
+
+void LowLatency::WaitForCompletions(std::stop_token a_stopToken)
+{
+	auto upscaling = Upscaling::GetSingleton();
+
+	uint64_t nextFrame = 1;
+	while (!a_stopToken.stop_requested()) {
+		if (fence->GetCompletedValue() < nextFrame) {
+			// An exception would terminate the game from this thread, low latency mode just stops measuring
+			if (HRESULT hr = fence->SetEventOnCompletion(nextFrame, fenceEvent); FAILED(hr)) {
+				logger::error("[Frame Generation] Low latency completion tracking stopped, waiting for frame {} failed: {:X}", nextFrame, (uint32_t)hr);
+				tracking = false;
+				return;
+			}
+			WaitForSingleObject(fenceEvent, 100);
+			continue;
+		}
+
+		// Several frames may complete at once, they all finished by now
+		int64_t timeNow = upscaling->clock.Now();
+		uint64_t completedValue = fence->GetCompletedValue();
+		for (; nextFrame <= completedValue; nextFrame++)
+			GetFrame(nextFrame).gpuComplete = timeNow;
+	}
+}
+
+void LowLatency::Present(ID3D12CommandQueue* a_commandQueue)
+{
+	if (!fence)
+		return;
+
+	// Read once, the stamp and the signal must be for the same frame
+	uint64_t frameIndex = frameCount;
+
+	auto& frame = GetFrame(frameIndex);
+	frame.present = Upscaling::GetSingleton()->clock.Now();
+
+	DX::ThrowIfFailed(a_commandQueue->Signal(fence.get(), frameIndex));
+}
+
+void LowLatency::QueueFrameStart(bool a_frameLimit, bool a_useFrameGeneration)
+{
+	// The message pump did not run since the last present, e.g. during loading
+	if (frameStartPending.exchange(false))
+		SimulationStart();
+
+	pendingFrameLimit = a_frameLimit;
+	pendingFrameGeneration = a_useFrameGeneration;
+
+	// Without a hook before the simulation, the next tick starts as soon as Present returns
+	if (frameStartHooked)
+		frameStartPending = true;
+	else
+		SimulationStart();
+}
+
+void LowLatency::UpdateEstimates()
+{
+	auto upscaling = Upscaling::GetSingleton();
+	bool lowLatencyMode = upscaling->settings.lowLatencyMode;
+
+	uint64_t currentFrame = frameCount;
+	for (uint64_t frameIndex = lastEstimatedFrame + 1; frameIndex <= currentFrame; frameIndex++) {
+		auto& frame = GetFrame(frameIndex);
+
+		int64_t gpuComplete = frame.gpuComplete;
+		if (!gpuComplete)
+			break;
+
+		int64_t simulationStart = frame.simulationStart;
+		int64_t present = frame.present;
+		int64_t previousGpuComplete = GetFrame(frameIndex - 1).gpuComplete;
+
+		if (simulationStart && present) {
+			cpuFrameTime += (double(present - simulationStart) - cpuFrameTime) * 0.1;
+			gpuFrameTime += (double(gpuComplete - std::max(present, previousGpuComplete)) - gpuFrameTime) * 0.1;
+
+			auto& stats = latencyStats[lowLatencyMode];
+			stats.total += double(gpuComplete - simulationStart);
+			stats.count++;
+
+			if (stats.count >= 1000) {
+				logger::info("[Frame Generation] Estimated input to present latency {:.2f} ms (low latency mode {})",
+					stats.total / double(stats.count) * 1000.0 / double(upscaling->clock.Frequency()),
+					lowLatencyMode ? "on" : "off");
+				stats = {};
+			}
+		}
+
+		lastEstimatedFrame = frameIndex;
+	}
+}
+
+void LowLatency::SimulationStart()
+{
+	ZoneScoped;
+
+	auto upscaling = Upscaling::GetSingleton();
+
+	// Waiting here rather than after Present keeps input sampling behind the frame queue
+	DX12SwapChain::GetSingleton()->WaitForFrameLatency();
+
+	if (upscaling->settings.lowLatencyMode) {
+		// Fix game running too fast
+		if (!upscaling->highFPSPhysicsFixLoaded)
+			upscaling->GameFrameLimiter();
+
+		if (pendingFrameLimit)
+			upscaling->FrameLimiter(pendingFrameGeneration);
+
+		if (fence && tracking) {
+			UpdateEstimates();
+
+			// Start the simulation so its submission lands just as the GPU finishes the previous frame
+			uint64_t currentFrame = frameCount;
+			auto& previous = GetFrame(currentFrame);
+			if (!previous.gpuComplete) {
+				auto& beforePrevious = GetFrame(currentFrame - 1);
+				int64_t beforePreviousComplete = beforePrevious.gpuComplete ? beforePrevious.gpuComplete.load() : beforePrevious.present + int64_t(gpuFrameTime);
+				int64_t predictedComplete = std::max(previous.present.load(), beforePreviousComplete) + int64_t(gpuFrameTime);
+
+				int64_t timeNow = upscaling->clock.Now();
+				int64_t maxWait = upscaling->clock.Frequency() / 20;
+				int64_t targetStart = std::min(predictedComplete - int64_t(cpuFrameTime), timeNow + maxWait);
+
+				if (timeNow < targetStart)
+					upscaling->TimerSleepQPC(targetStart);
+			}
+		}
+	} else if (fence && tracking) {
+		UpdateEstimates();
+	}
+
+	// The slot is reset before the new frame is published, Present never stamps a frame that is still being cleared
+	uint64_t nextFrame = frameCount + 1;
+
+	auto& frame = GetFrame(nextFrame);
+	frame.present = 0;
+	frame.gpuComplete = 0;
+	frame.simulationStart = upscaling->clock.Now();
+
+	frameCount = nextFrame;
+}
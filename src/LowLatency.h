@@ -0,0 +1,76 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <thread>
+
+#include <winrt/base.h>
+
+#include <d3d12.h>
+
+// Reflex-style latency reduction: measures GPU completion of each frame on the game queue and
+// delays the start of the next simulation tick so the render queue stays near empty
+class LowLatency
+{
+public:
+	static LowLatency* GetSingleton()
+	{
+		static LowLatency singleton;
+		return &singleton;
+	}
+
+	static constexpr size_t kFrameHistory = 16;
+
+	struct FrameTimes
+	{
+		std::atomic<int64_t> simulationStart = 0;
+		std::atomic<int64_t> present = 0;
+		std::atomic<int64_t> gpuComplete = 0;
+	};
+
+	struct LatencyStats
+	{
+		double total = 0.0;
+		uint64_t count = 0;
+	};
+
+	winrt::com_ptr<ID3D12Fence> fence;
+	HANDLE fenceEvent = nullptr;
+
+	std::array<FrameTimes, kFrameHistory> frames;
+
+	// Advanced by SimulationStart on the message pump thread, read by Present on the render thread
+	std::atomic<uint64_t> frameCount = 1;
+
+	// Only touched by SimulationStart, which frameStartPending hands to one thread at a time
+	uint64_t lastEstimatedFrame = 0;
+
+	// Moving averages in QPC ticks
+	double cpuFrameTime = 0.0;
+	double gpuFrameTime = 0.0;
+
+	LatencyStats latencyStats[2];
+
+	std::atomic<bool> frameStartPending = false;
+	bool frameStartHooked = false;
+
+	// Written by Present before frameStartPending is set, read by the thread that takes it
+	std::atomic<bool> pendingFrameLimit = false;
+	std::atomic<bool> pendingFrameGeneration = false;
+
+	// Cleared if the completion thread stops, completions are no longer timed and SimulationStart stops waiting on them
+	std::atomic<bool> tracking = false;
+	std::jthread completionThread;
+
+	void CreateFence(ID3D12Device* a_device);
+
+	void Present(ID3D12CommandQueue* a_commandQueue);
+	void QueueFrameStart(bool a_frameLimit, bool a_useFrameGeneration);
+	void SimulationStart();
+
+private:
+	FrameTimes& GetFrame(uint64_t a_frame) { return frames[a_frame % kFrameHistory]; }
+
+	void UpdateEstimates();
+	void WaitForCompletions(std::stop_token a_stopToken);
+};
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+
+// Platform independent so the wait logic can be driven by a fake clock.
+//
+// A Clock provides:
+//   int64_t Now()                 current time in ticks
+//   int64_t Frequency()           ticks per second
+//   void Block(int64_t a_ticks)   coarse OS wait, may return late
+//   void Pause()                  single spin iteration
+
+struct SleepStats
+{
+	// Most recent wait
+	int64_t requestedTicks = 0;
+	int64_t blockedTicks = 0;
+	int64_t spinTicks = 0;
+	int64_t overshootTicks = 0;
+
+	// Aggregate since the last Reset()
+	uint64_t count = 0;
+	int64_t totalOvershootTicks = 0;
+	int64_t maxOvershootTicks = 0;
+	int64_t totalSpinTicks = 0;
+
+	void Reset()
+	{
+		count = 0;
+		totalOvershootTicks = 0;
+		maxOvershootTicks = 0;
+		totalSpinTicks = 0;
+	}
+};
+
+template <class Clock>
+class PreciseSleeper
+{
+public:
+	explicit PreciseSleeper(Clock& a_clock) :
+		clock(a_clock) {}
+
+	void SetSpinMargin(double a_milliseconds)
+	{
+		spinMarginTicks = std::max<int64_t>(0, int64_t(a_milliseconds * double(clock.Frequency()) / 1000.0));
+	}
+
+	int64_t GetSpinMargin() const { return spinMarginTicks; }
+
+	// Blocks on the OS timer until the spin margin, then spins to the deadline, returns the ticks slept
+	int64_t SleepUntil(int64_t a_targetTicks)
+	{
+		int64_t start = clock.Now();
+		if (start >= a_targetTicks)
+			return 0;
+
+		int64_t remaining = a_targetTicks - start;
+		if (remaining > spinMarginTicks)
+			clock.Block(remaining - spinMarginTicks);
+
+		int64_t spinStart = clock.Now();
+
+		int64_t now = spinStart;
+		while (now < a_targetTicks) {
+			clock.Pause();
+			now = clock.Now();
+		}
+
+		stats.requestedTicks = remaining;
+		stats.blockedTicks = spinStart - start;
+		stats.spinTicks = std::max<int64_t>(0, now - spinStart);
+		stats.overshootTicks = now - a_targetTicks;
+
+		stats.count++;
+		stats.totalOvershootTicks += stats.overshootTicks;
+		stats.maxOvershootTicks = std::max(stats.maxOvershootTicks, stats.overshootTicks);
+		stats.totalSpinTicks += stats.spinTicks;
+
+		return now - start;
+	}
+
+	SleepStats stats;
+
+private:
+	Clock& clock;
+	int64_t spinMarginTicks = 0;
+};
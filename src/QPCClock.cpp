@@ -0,0 +1,56 @@
+#include "QPCClock.h"
+
+#include <timeapi.h>
+
+#pragma comment(lib, "winmm.lib")
+
+QPCClock::QPCClock()
+{
+	LARGE_INTEGER qpf;
+	QueryPerformanceFrequency(&qpf);
+	frequency = qpf.QuadPart;
+
+	timer = CreateWaitableTimerExW(nullptr, nullptr, CREATE_WAITABLE_TIMER_HIGH_RESOLUTION, TIMER_ALL_ACCESS);
+	highResolution = timer != nullptr;
+
+	// Still far better than spinning the whole interval, the default 15.6 ms resolution would not be
+	if (!timer) {
+		timer = CreateWaitableTimerExW(nullptr, nullptr, 0, TIMER_ALL_ACCESS);
+		if (timer)
+			timerPeriodSet = timeBeginPeriod(1) == TIMERR_NOERROR;
+	}
+}
+
+QPCClock::~QPCClock()
+{
+	if (timerPeriodSet)
+		timeEndPeriod(1);
+	if (timer)
+		CloseHandle(timer);
+}
+
+int64_t QPCClock::Now()
+{
+	LARGE_INTEGER qpc;
+	QueryPerformanceCounter(&qpc);
+	return qpc.QuadPart;
+}
+
+void QPCClock::Block(int64_t a_ticks)
+{
+	// Without any timer the whole interval is spun
+	if (!timer || a_ticks <= 0)
+		return;
+
+	// Relative due time in 100ns units
+	LARGE_INTEGER dueTime;
+	dueTime.QuadPart = -std::max<int64_t>(1, a_ticks * 10'000'000 / frequency);
+
+	if (SetWaitableTimerEx(timer, &dueTime, 0, nullptr, nullptr, nullptr, 0))
+		WaitForSingleObject(timer, INFINITE);
+}
+
+void QPCClock::Pause()
+{
+	YieldProcessor();
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+// QueryPerformanceCounter clock backed by a high resolution waitable timer, or before Windows 10 1803
+// by a normal waitable timer at 1 ms system timer resolution
+class QPCClock
+{
+public:
+	// Milliseconds a normal waitable timer can wake late at 1 ms resolution, the least spin margin it needs
+	static constexpr double kCoarseTimerSpinMargin = 2.0;
+
+	QPCClock();
+	~QPCClock();
+
+	int64_t Now();
+	int64_t Frequency() const { return frequency; }
+	void Block(int64_t a_ticks);
+	void Pause();
+
+	bool HasHighResolutionTimer() const { return highResolution; }
+	bool HasTimer() const { return timer != nullptr; }
+
+private:
+	int64_t frequency = 0;
+	HANDLE timer = nullptr;
+	bool highResolution = false;
+	bool timerPeriodSet = false;
+};
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <cstddef>
+
+#include <d3d12.h>
+
+#include "ResourceStateTrackerCore.h"
+
+// Tracks the current state of the D3D12 resources the plugin owns and batches transitions, so each
+// sync point issues at most one ResourceBarrier call and transitions to the current state are dropped.
+// Templated on the command list so it can be driven by anything with a ResourceBarrier method.
+template <class CommandList, size_t Capacity = 32>
+class ResourceStateTracker
+{
+public:
+	using Core = ResourceStateTrackerCore<ID3D12Resource, D3D12_RESOURCE_STATES, Capacity>;
+
+	// Registers a resource, or overrides its state after work the tracker did not record
+	void Track(ID3D12Resource* a_resource, D3D12_RESOURCE_STATES a_state)
+	{
+		if (core.Track(a_resource, a_state) == Core::Status::kFull)
+			logger::error("[Frame Generation] Resource state tracker is full, {} resources are tracked", Capacity);
+	}
+
+	void Untrack(ID3D12Resource* a_resource) { core.Untrack(a_resource); }
+
+	D3D12_RESOURCE_STATES GetState(ID3D12Resource* a_resource) const { return core.GetState(a_resource, D3D12_RESOURCE_STATE_COMMON); }
+
+	// Queues a transition, merging with one already pending for the same resource
+	void Transition(ID3D12Resource* a_resource, D3D12_RESOURCE_STATES a_state)
+	{
+		// Either is a missing Track call or barrier batch, the resource is then used in the wrong state
+		switch (core.Transition(a_resource, a_state)) {
+		case Core::Status::kUntracked:
+			logger::error("[Frame Generation] Transition of untracked resource {} to {:#x}", (void*)a_resource, (uint32_t)a_state);
+			break;
+		case Core::Status::kFull:
+			logger::error("[Frame Generation] More than {} transitions queued before a flush, {} to {:#x} is dropped", Capacity, (void*)a_resource, (uint32_t)a_state);
+			break;
+		default:
+			break;
+		}
+	}
+
+	// Issues everything queued since the last flush as one barrier call
+	void Flush(CommandList* a_commandList)
+	{
+		core.Flush([&](const typename Core::PendingTransition* a_transitions, size_t a_count) {
+			D3D12_RESOURCE_BARRIER barriers[Capacity];
+			for (size_t i = 0; i < a_count; i++) {
+				auto& barrier = barriers[i];
+				barrier.Type = D3D12_RESOURCE_BARRIER_TYPE_TRANSITION;
+				barrier.Flags = D3D12_RESOURCE_BARRIER_FLAG_NONE;
+				barrier.Transition.pResource = a_transitions[i].resource;
+				barrier.Transition.Subresource = D3D12_RESOURCE_BARRIER_ALL_SUBRESOURCES;
+				barrier.Transition.StateBefore = a_transitions[i].before;
+				barrier.Transition.StateAfter = a_transitions[i].after;
+			}
+			a_commandList->ResourceBarrier(static_cast<UINT>(a_count), barriers);
+		});
+	}
+
+	size_t GetPendingCount() const { return core.GetPendingCount(); }
+
+private:
+	Core core;
+};
@@ -0,0 +1,138 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Platform independent part of ResourceStateTracker, so the batching can be tested without D3D12.
+// Resource is only compared by address and State only for equality, transitions are queued in
+// fixed arrays and handed to a callback at the sync point, which turns them into barriers.
+template <class Resource, class State, size_t Capacity = 32>
+class ResourceStateTrackerCore
+{
+public:
+	enum class Status
+	{
+		kOk,
+		kUntracked,
+		kFull
+	};
+
+	struct PendingTransition
+	{
+		Resource* resource;
+		State before;
+		State after;
+	};
+
+	// Registers a resource, or overrides its state after work the tracker did not record
+	Status Track(Resource* a_resource, State a_state)
+	{
+		if (auto entry = Find(a_resource)) {
+			entry->state = a_state;
+			return Status::kOk;
+		}
+
+		if (count == Capacity)
+			return Status::kFull;
+
+		entries[count++] = { a_resource, a_state };
+		return Status::kOk;
+	}
+
+	void Untrack(Resource* a_resource)
+	{
+		for (size_t i = 0; i < count; i++) {
+			if (entries[i].resource == a_resource) {
+				entries[i] = entries[--count];
+				return;
+			}
+		}
+	}
+
+	bool IsTracked(Resource* a_resource) const
+	{
+		for (size_t i = 0; i < count; i++) {
+			if (entries[i].resource == a_resource)
+				return true;
+		}
+		return false;
+	}
+
+	State GetState(Resource* a_resource, State a_default) const
+	{
+		for (size_t i = 0; i < count; i++) {
+			if (entries[i].resource == a_resource)
+				return entries[i].state;
+		}
+		return a_default;
+	}
+
+	// Queues a transition, merging with one already pending for the same resource. Nothing is
+	// recorded on failure, the tracked state stays what the issued barriers left it at
+	Status Transition(Resource* a_resource, State a_state)
+	{
+		auto entry = Find(a_resource);
+		if (!entry)
+			return Status::kUntracked;
+
+		if (entry->state == a_state)
+			return Status::kOk;
+
+		for (size_t i = 0; i < pendingCount; i++) {
+			auto& transition = pending[i];
+			if (transition.resource == a_resource) {
+				// A round trip within one sync point cancels out
+				if (transition.before == a_state)
+					pending[i] = pending[--pendingCount];
+				else
+					transition.after = a_state;
+
+				entry->state = a_state;
+				return Status::kOk;
+			}
+		}
+
+		if (pendingCount == Capacity)
+			return Status::kFull;
+
+		pending[pendingCount++] = { a_resource, entry->state, a_state };
+		entry->state = a_state;
+		return Status::kOk;
+	}
+
+	// Hands everything queued since the last flush to a_issue(const PendingTransition*, size_t) in one call
+	template <class IssueFunc>
+	void Flush(IssueFunc&& a_issue)
+	{
+		if (!pendingCount)
+			return;
+
+		a_issue(static_cast<const PendingTransition*>(pending), pendingCount);
+		pendingCount = 0;
+	}
+
+	size_t GetCount() const { return count; }
+	size_t GetPendingCount() const { return pendingCount; }
+
+private:
+	struct Entry
+	{
+		Resource* resource;
+		State state;
+	};
+
+	Entry* Find(Resource* a_resource)
+	{
+		for (size_t i = 0; i < count; i++) {
+			if (entries[i].resource == a_resource)
+				return &entries[i];
+		}
+		return nullptr;
+	}
+
+	Entry entries[Capacity]{};
+	size_t count = 0;
+
+	PendingTransition pending[Capacity]{};
+	size_t pendingCount = 0;
+};
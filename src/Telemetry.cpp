@@ -0,0 +1,113 @@
+#include "Telemetry.h"
+
+#include "Upscaling.h"
+
+void Telemetry::Start()
+{
+	auto path = logger::log_directory();
+	if (!path) {
+		logger::error("[Telemetry] Failed to find standard logging directory");
+		return;
+	}
+
+	*path /= std::format("{}.trace"sv, Plugin::NAME);
+
+	if (_wfopen_s(&file, path->c_str(), L"wb") != 0 || !file) {
+		logger::error("[Telemetry] Failed to open {}", path->string());
+		return;
+	}
+
+	TraceHeader header{};
+	header.frequency = Upscaling::GetSingleton()->clock.Frequency();
+	fwrite(&header, sizeof(header), 1, file);
+
+	enabled = true;
+	flushThread = std::jthread([this](std::stop_token a_stopToken) { Flush(a_stopToken); });
+
+	logger::info("[Telemetry] Writing frame trace to {}", path->string());
+}
+
+void Telemetry::Mark(Event a_event)
+{
+	if (!enabled)
+		return;
+
+	current.timestamps[(size_t)a_event] = Upscaling::GetSingleton()->clock.Now();
+}
+
+void Telemetry::AddLimiterSleep(int64_t a_ticks)
+{
+	if (!enabled)
+		return;
+
+	current.limiterSleepTicks += a_ticks;
+}
+
+void Telemetry::SetFrameGeneration(bool a_useFrameGeneration)
+{
+	if (!enabled)
+		return;
+
+	if (a_useFrameGeneration)
+		current.flags |= kFrameGeneration;
+	else
+		current.flags &= ~kFrameGeneration;
+}
+
+void Telemetry::AddGPUPass(GPUProfiler::Pass a_pass, uint64_t a_frameID, int64_t a_begin, int64_t a_end)
+{
+	if (!enabled)
+		return;
+
+	current.gpuPasses[(size_t)a_pass] = { a_frameID, a_begin, a_end };
+}
+
+void Telemetry::EndFrame()
+{
+	if (!enabled)
+		return;
+
+	// Single producer, drop the frame rather than block the render thread when the writer falls behind
+	uint64_t writeIndex = head.load(std::memory_order_relaxed);
+	if (writeIndex - tail.load(std::memory_order_acquire) < kRingSize) {
+		ring[writeIndex % kRingSize] = current;
+		head.store(writeIndex + 1, std::memory_order_release);
+	} else {
+		dropped.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	uint64_t frameID = current.frameID + 1;
+	current = {};
+	current.frameID = frameID;
+}
+
+void Telemetry::Flush(std::stop_token a_stopToken)
+{
+	while (true) {
+		bool stopping = a_stopToken.stop_requested();
+
+		uint64_t readIndex = tail.load(std::memory_order_relaxed);
+		uint64_t writeIndex = head.load(std::memory_order_acquire);
+
+		// Contiguous runs straight from the ring
+		while (readIndex != writeIndex) {
+			size_t start = readIndex % kRingSize;
+			size_t count = (size_t)std::min<uint64_t>(writeIndex - readIndex, kRingSize - start);
+			fwrite(&ring[start], sizeof(FrameRecord), count, file);
+			readIndex += count;
+			tail.store(readIndex, std::memory_order_release);
+		}
+
+		if (auto droppedFrames = dropped.exchange(0))
+			logger::warn("[Telemetry] Dropped {} frames", droppedFrames);
+
+		if (stopping)
+			break;
+
+		fflush(file);
+		std::this_thread::sleep_for(100ms);
+	}
+
+	fclose(file);
+	file = nullptr;
+}
@@ -0,0 +1,101 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdio>
+#include <thread>
+
+#include "GPUProfiler.h"
+
+// Per-frame timestamps collected on the render thread into a lock-free ring,
+// streamed to a binary trace file by a background thread
+class Telemetry
+{
+public:
+	static Telemetry* GetSingleton()
+	{
+		static Telemetry singleton;
+		return &singleton;
+	}
+
+	enum class Event : uint32_t
+	{
+		kDrawWorldReticle,
+		kPostAlpha,
+		kCopyBuffersToSharedResources,
+		kPostDisplay,
+		kFenceSignal,
+		kFenceWait,
+		kFrameGenerationDispatch,
+		kPresent,
+		kPresentReturn,
+		kFramesAheadWait,
+		kFramesAheadWaitReturn,
+		kSlotReuseWait,
+		kSlotReuseWaitReturn,
+		kFrameLatencyWait,
+		kFrameLatencyWaitReturn,
+
+		kCount
+	};
+
+	enum Flags : uint32_t
+	{
+		kFrameGeneration = 1 << 0
+	};
+
+	// GPU results arrive a few frames late, frameID names the frame they were measured in
+	struct GPUPass
+	{
+		uint64_t frameID;
+		int64_t begin;
+		int64_t end;
+	};
+
+	struct FrameRecord
+	{
+		uint64_t frameID;
+		int64_t timestamps[(size_t)Event::kCount];
+		int64_t limiterSleepTicks;
+		uint32_t flags;
+		uint32_t padding;
+		GPUPass gpuPasses[GPUProfiler::kPassCount];
+	};
+
+	// File layout is a TraceHeader followed by FrameRecords, all little endian
+	struct TraceHeader
+	{
+		uint32_t magic = 0x52544746;  // "FGTR"
+		uint32_t version = 6;
+		int64_t frequency = 0;
+		uint32_t eventCount = (uint32_t)Event::kCount;
+		uint32_t recordSize = sizeof(FrameRecord);
+		uint32_t gpuPassCount = GPUProfiler::kPassCount;
+		uint32_t padding = 0;
+	};
+
+	static constexpr size_t kRingSize = 1024;
+
+	bool enabled = false;
+
+	void Start();
+
+	void Mark(Event a_event);
+	void AddLimiterSleep(int64_t a_ticks);
+	void SetFrameGeneration(bool a_useFrameGeneration);
+	void AddGPUPass(GPUProfiler::Pass a_pass, uint64_t a_frameID, int64_t a_begin, int64_t a_end);
+	void EndFrame();
+
+private:
+	void Flush(std::stop_token a_stopToken);
+
+	FrameRecord current{};
+
+	std::array<FrameRecord, kRingSize> ring{};
+	std::atomic<uint64_t> head = 0;
+	std::atomic<uint64_t> tail = 0;
+	std::atomic<uint64_t> dropped = 0;
+
+	FILE* file = nullptr;
+	std::jthread flushThread;
+};
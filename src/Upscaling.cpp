@@ -1,9 +1,14 @@
 #include "Upscaling.h"
 
+#include <DirectXTex.h>
 #include <d3dcompiler.h>
 
 #include "DX12SwapChain.h"
+#include "DepthMotionVectorUnpack.h"
 #include "DirectXMath.h"
+#include "GPUProfiler.h"
+#include "GameRenderState.h"
+#include "Telemetry.h"
 
 enum class RenderTarget
 {
@@ -79,7 +84,79 @@ enum class DepthStencilTarget
 	kCount = 13
 };
 
-ID3D11DeviceChild* CompileShader(const wchar_t* FilePath, const char* ProgramType, const char* Program = "main")
+// Swaps the objects behind a game render target, keeping the single reference the game holds on each
+static void SetRenderTarget(RE::BSGraphics::RenderTarget& a_target, ID3D11Texture2D* a_texture, ID3D11RenderTargetView* a_rtv, ID3D11ShaderResourceView* a_srv)
+{
+	auto texture = reinterpret_cast<ID3D11Texture2D*>(a_target.texture);
+	auto rtView = reinterpret_cast<ID3D11RenderTargetView*>(a_target.rtView);
+	auto srView = reinterpret_cast<ID3D11ShaderResourceView*>(a_target.srView);
+
+	if (texture == a_texture && rtView == a_rtv)
+		return;
+
+	a_texture->AddRef();
+	a_rtv->AddRef();
+
+	if (texture)
+		texture->Release();
+	if (rtView)
+		rtView->Release();
+
+	a_target.texture = reinterpret_cast<decltype(a_target.texture)>(a_texture);
+	a_target.rtView = reinterpret_cast<decltype(a_target.rtView)>(a_rtv);
+
+	// Only replaced when the game created one itself
+	if (srView && a_srv) {
+		a_srv->AddRef();
+		srView->Release();
+		a_target.srView = reinterpret_cast<decltype(a_target.srView)>(a_srv);
+	}
+}
+
+// Opens a shared D3D11 texture on the D3D12 device, where it starts out in COMMON
+static void ShareWithD3D12(Texture2D* a_texture, winrt::com_ptr<ID3D12Resource>& a_resource12)
+{
+	auto dx12SwapChain = DX12SwapChain::GetSingleton();
+	if (!dx12SwapChain->swapChain)
+		return;
+
+	winrt::com_ptr<IDXGIResource1> dxgiResource;
+	DX::ThrowIfFailed(a_texture->resource->QueryInterface(IID_PPV_ARGS(dxgiResource.put())));
+
+	HANDLE sharedHandle = nullptr;
+	DX::ThrowIfFailed(dxgiResource->CreateSharedHandle(
+		nullptr,
+		DXGI_SHARED_RESOURCE_READ | DXGI_SHARED_RESOURCE_WRITE,
+		nullptr,
+		&sharedHandle));
+
+	DX::ThrowIfFailed(dx12SwapChain->d3d12Device->OpenSharedHandle(
+		sharedHandle,
+		IID_PPV_ARGS(&a_resource12)));
+
+	CloseHandle(sharedHandle);
+
+	dx12SwapChain->stateTracker.Track(a_resource12.get(), D3D12_RESOURCE_STATE_COMMON);
+}
+
+extern bool enbLoaded;
+
+struct ID3D11DeviceContext_OMSetDepthStencilState
+{
+	static void STDMETHODCALLTYPE thunk(ID3D11DeviceContext* This, ID3D11DepthStencilState* pDepthStencilState, UINT StencilRef)
+	{
+		auto upscaling = Upscaling::GetSingleton();
+		if (upscaling->alphaStencilActive) {
+			upscaling->gameDepthStencilState = pDepthStencilState;
+			upscaling->gameStencilRef = StencilRef;
+			pDepthStencilState = upscaling->GetAlphaStencilState(pDepthStencilState, StencilRef);
+		}
+		func(This, pDepthStencilState, StencilRef);
+	}
+	static inline REL::Relocation<decltype(thunk)> func;
+};
+
+ID3D11DeviceChild* CompileShader(const wchar_t* FilePath, const char* ProgramType, const char* Program = "main", const D3D_SHADER_MACRO* Defines = nullptr)
 {
 	auto rendererData = RE::BSGraphics::RendererData::GetSingleton();
 	auto device = reinterpret_cast<ID3D11Device*>(rendererData->device);
@@ -99,13 +176,19 @@ ID3D11DeviceChild* CompileShader(const wchar_t* FilePath, const char* ProgramTyp
 		logger::error("Failed to compile shader; {} does not exist", str);
 		return nullptr;
 	}
-	if (FAILED(D3DCompileFromFile(FilePath, nullptr, D3D_COMPILE_STANDARD_FILE_INCLUDE, Program, ProgramType, flags, 0, &shaderBlob, &shaderErrors))) {
+	if (FAILED(D3DCompileFromFile(FilePath, Defines, D3D_COMPILE_STANDARD_FILE_INCLUDE, Program, ProgramType, flags, 0, &shaderBlob, &shaderErrors))) {
 		logger::warn("Shader compilation failed:\n\n{}", shaderErrors ? static_cast<char*>(shaderErrors->GetBufferPointer()) : "Unknown error");
 		return nullptr;
 	}
 	if (shaderErrors)
 		logger::debug("Shader logs:\n{}", static_cast<char*>(shaderErrors->GetBufferPointer()));
 
+	if (std::string_view(ProgramType).starts_with("vs_")) {
+		ID3D11VertexShader* vertexShader;
+		DX::ThrowIfFailed(device->CreateVertexShader(shaderBlob->GetBufferPointer(), shaderBlob->GetBufferSize(), nullptr, &vertexShader));
+		return vertexShader;
+	}
+
 	ID3D11ComputeShader* regShader;
 	DX::ThrowIfFailed(device->CreateComputeShader(shaderBlob->GetBufferPointer(), shaderBlob->GetBufferSize(), nullptr, &regShader));
 	return regShader;
@@ -121,9 +204,54 @@ void Upscaling::LoadSettings()
 
 	settings.frameGenerationMode = ini.GetBoolValue("Settings", "bFrameGenerationMode", true);
 	settings.frameLimitMode = ini.GetBoolValue("Settings", "bFrameLimitMode", true);
+	settings.adaptiveFrameLimit = ini.GetBoolValue("Settings", "bAdaptiveFrameLimit", false);
+	settings.lowLatencyMode = ini.GetBoolValue("Settings", "bLowLatencyMode", false);
+	settings.telemetry = ini.GetBoolValue("Settings", "bTelemetry", false);
+	settings.gpuProfiling = ini.GetBoolValue("Settings", "bGPUProfiling", false);
+	settings.zeroCopyMotionVectors = ini.GetBoolValue("Settings", "bZeroCopyMotionVectors", false);
+	settings.packDepthMotionVectors = ini.GetBoolValue("Settings", "bPackDepthMotionVectors", false);
+	settings.alphaMaskMode = (AlphaMaskMode)std::clamp(ini.GetLongValue("Settings", "iAlphaMaskMode", 0), 0l, (long)AlphaMaskMode::kStencil);
+	settings.depthPrecision = (DepthPrecision)std::clamp(ini.GetLongValue("Settings", "iDepthPrecision", 0), 0l, (long)DepthPrecision::kUnorm16);
+	settings.halfMotionVectors = ini.GetBoolValue("Settings", "bHalfMotionVectors", false);
+	settings.captureInterval = (uint32_t)std::max(ini.GetLongValue("Settings", "iCaptureInterval", 0), 0l);
+	settings.frameRingDepth = (uint32_t)std::clamp(ini.GetLongValue("Settings", "iFrameRingDepth", 2), (long)FrameRing::kMinDepth, (long)FrameRing::kMaxDepth);
+	settings.maxFramesAhead = (uint32_t)std::clamp(ini.GetLongValue("Settings", "iMaxFramesAhead", 1), 1l, (long)settings.frameRingDepth);
+	settings.maxFrameLatency = (uint32_t)std::clamp(ini.GetLongValue("Settings", "iMaxFrameLatency", 1), 1l, (long)DXGI_MAX_SWAP_CHAIN_BUFFERS);
+	settings.transferQueue = (uint32_t)std::clamp(ini.GetLongValue("Settings", "iTransferQueue", 0), 0l, 2l);
+	settings.sleepSpinMargin = (float)ini.GetDoubleValue("Settings", "fSleepSpinMargin", 0.75);
 
 	logger::info("[Frame Generation] bFrameGenerationMode: {}", settings.frameGenerationMode);
 	logger::info("[Frame Generation] bFrameLimitMode: {}", settings.frameLimitMode);
+	logger::info("[Frame Generation] bAdaptiveFrameLimit: {}", settings.adaptiveFrameLimit);
+	logger::info("[Frame Generation] bLowLatencyMode: {}", settings.lowLatencyMode);
+	logger::info("[Frame Generation] bTelemetry: {}", settings.telemetry);
+	logger::info("[Frame Generation] bGPUProfiling: {}", settings.gpuProfiling);
+	logger::info("[Frame Generation] bZeroCopyMotionVectors: {}", settings.zeroCopyMotionVectors);
+	logger::info("[Frame Generation] bPackDepthMotionVectors: {}", settings.packDepthMotionVectors);
+	logger::info("[Frame Generation] iAlphaMaskMode: {}", (uint32_t)settings.alphaMaskMode);
+	logger::info("[Frame Generation] iDepthPrecision: {}", (uint32_t)settings.depthPrecision);
+	logger::info("[Frame Generation] bHalfMotionVectors: {}", settings.halfMotionVectors);
+	logger::info("[Frame Generation] iCaptureInterval: {}", settings.captureInterval);
+	logger::info("[Frame Generation] iFrameRingDepth: {}", settings.frameRingDepth);
+	logger::info("[Frame Generation] iMaxFramesAhead: {}", settings.maxFramesAhead);
+	logger::info("[Frame Generation] iMaxFrameLatency: {}", settings.maxFrameLatency);
+	logger::info("[Frame Generation] iTransferQueue: {}", settings.transferQueue);
+	logger::info("[Frame Generation] fSleepSpinMargin: {}", settings.sleepSpinMargin);
+
+	// A normal timer wakes later, so more of the wait is left to the spin
+	if (clock.HasHighResolutionTimer()) {
+		sleeper.SetSpinMargin(settings.sleepSpinMargin);
+	} else if (clock.HasTimer()) {
+		double spinMargin = std::max((double)settings.sleepSpinMargin, QPCClock::kCoarseTimerSpinMargin);
+		sleeper.SetSpinMargin(spinMargin);
+		logger::warn("[Frame Generation] High resolution waitable timer is unavailable (needs Windows 10 1803), using a normal timer with a {} ms spin margin", spinMargin);
+	} else {
+		sleeper.SetSpinMargin(settings.sleepSpinMargin);
+		logger::warn("[Frame Generation] No waitable timer could be created, frame limiter will spin");
+	}
+
+	if (settings.telemetry)
+		Telemetry::GetSingleton()->Start();
 }
 
 void Upscaling::PostPostLoad()
@@ -140,14 +268,61 @@ void Upscaling::PostPostLoad()
 
 void Upscaling::CreateFrameGenerationResources()
 {
-	logger::info("[Frame Generation] Creating resources");
-	
 	setupBuffers = true;
 
+	// A size measured against the old shared inputs may not fit the new ones
+	renderSizeMeasured = false;
+
 	auto rendererData = RE::BSGraphics::RendererData::GetSingleton();
 	auto& main = rendererData->renderTargets[(uint)RenderTarget::kMain];
 
-	for (int index = 0; index < 2; index++) {
+	auto dx12SwapChain = DX12SwapChain::GetSingleton();
+
+	// Kept across swap chain resizes while the game's render targets stay exactly the same size, any other size recreates them
+	if (HUDLessBufferShared[0]) {
+		if (!SharedInputSizeChanged())
+			return;
+
+		// Outside ResizeBuffers FSR may still be reading them
+		dx12SwapChain->Drain();
+		ReleaseFrameGenerationResources();
+	}
+
+	logger::info("[Frame Generation] Creating resources");
+
+	auto& motionVector = rendererData->renderTargets[(uint)RenderTarget::kMotionVectors];
+	D3D11_TEXTURE2D_DESC texDescMotionVector{};
+	reinterpret_cast<ID3D11Texture2D*>(motionVector.texture)->GetDesc(&texDescMotionVector);
+
+	// Only 32-bit float motion vectors are worth halving, anything else is shared as the game renders it
+	DXGI_FORMAT motionVectorFormat = texDescMotionVector.Format;
+	if (settings.halfMotionVectors && (motionVectorFormat == DXGI_FORMAT_R32G32_FLOAT || motionVectorFormat == DXGI_FORMAT_R32G32_TYPELESS))
+		motionVectorFormat = DXGI_FORMAT_R16G16_FLOAT;
+
+	motionVectorsConverted = motionVectorFormat != texDescMotionVector.Format;
+
+	DXGI_FORMAT depthFormat = DXGI_FORMAT_R32_FLOAT;
+	if (settings.depthPrecision == DepthPrecision::kFloat16)
+		depthFormat = DXGI_FORMAT_R16_FLOAT;
+	else if (settings.depthPrecision == DepthPrecision::kUnorm16)
+		depthFormat = DXGI_FORMAT_R16_UNORM;
+
+	// Half precision motion vectors fit next to the depth without losing anything
+	depthMotionVectorsPacked = settings.packDepthMotionVectors && motionVectorFormat == DXGI_FORMAT_R16G16_FLOAT;
+	if (settings.packDepthMotionVectors && !depthMotionVectorsPacked)
+		logger::warn("[Frame Generation] Motion vector format {} cannot be packed with depth, using separate textures", magic_enum::enum_name(texDescMotionVector.Format));
+	// Nothing would split the packed texture for FSR, which would then read textures no pass wrote
+	if (depthMotionVectorsPacked && (!dx12SwapChain->d3d12Device || !DepthMotionVectorUnpack::GetSingleton()->CreatePipeline(dx12SwapChain->d3d12Device.get()))) {
+		logger::warn("[Frame Generation] Depth and motion vector unpack pipeline is unavailable, using separate textures");
+		depthMotionVectorsPacked = false;
+	}
+	if (depthMotionVectorsPacked && settings.depthPrecision != DepthPrecision::kFloat32)
+		logger::warn("[Frame Generation] Packed depth is always stored as 32-bit float, iDepthPrecision is ignored");
+
+	logger::info("[Frame Generation] Shared depth is {}, motion vectors are {}{}", magic_enum::enum_name(depthMotionVectorsPacked ? DXGI_FORMAT_R32_FLOAT : depthFormat),
+		magic_enum::enum_name(motionVectorFormat), depthMotionVectorsPacked ? ", packed" : "");
+
+	for (uint32_t index = 0; index < dx12SwapChain->frameRing.GetDepth(); index++) {
 		D3D11_TEXTURE2D_DESC texDesc{};
 		D3D11_SHADER_RESOURCE_VIEW_DESC srvDesc = {};
 		D3D11_RENDER_TARGET_VIEW_DESC rtvDesc = {};
@@ -157,7 +332,8 @@ void Upscaling::CreateFrameGenerationResources()
 		reinterpret_cast<ID3D11ShaderResourceView*>(main.srView)->GetDesc(&srvDesc);
 		reinterpret_cast<ID3D11RenderTargetView*>(main.rtView)->GetDesc(&rtvDesc);
 
-		texDesc.BindFlags |= D3D11_BIND_UNORDERED_ACCESS;
+		// Only written by copies and compute, without the render target flag drivers can keep them compressed
+		texDesc.BindFlags = D3D11_BIND_SHADER_RESOURCE | D3D11_BIND_UNORDERED_ACCESS;
 
 		uavDesc.Format = texDesc.Format;
 		uavDesc.ViewDimension = D3D11_UAV_DIMENSION_TEXTURE2D;
@@ -167,121 +343,394 @@ void Upscaling::CreateFrameGenerationResources()
 
 		texDesc.Format = DXGI_FORMAT_R8G8B8A8_UNORM;
 		srvDesc.Format = texDesc.Format;
-		rtvDesc.Format = texDesc.Format;
 		uavDesc.Format = texDesc.Format;
 
 		HUDLessBufferShared[index] = new Texture2D(texDesc);
 		HUDLessBufferShared[index]->CreateSRV(srvDesc);
-		HUDLessBufferShared[index]->CreateRTV(rtvDesc);
 		HUDLessBufferShared[index]->CreateUAV(uavDesc);
 
-		texDesc.Format = DXGI_FORMAT_R32_FLOAT;
+		ShareWithD3D12(HUDLessBufferShared[index], HUDLessBufferShared12[index]);
+
+		if (depthMotionVectorsPacked) {
+			texDesc.Format = DepthMotionVectorUnpack::kPackedFormat;
+			uavDesc.Format = texDesc.Format;
+
+			depthMotionVectorShared[index] = new Texture2D(texDesc);
+			depthMotionVectorShared[index]->CreateUAV(uavDesc);
+
+			ShareWithD3D12(depthMotionVectorShared[index], depthMotionVectorShared12[index]);
+			continue;
+		}
+
+		texDesc.Format = depthFormat;
 		srvDesc.Format = texDesc.Format;
-		rtvDesc.Format = texDesc.Format;
 		uavDesc.Format = texDesc.Format;
 
 		depthBufferShared[index] = new Texture2D(texDesc);
 		depthBufferShared[index]->CreateSRV(srvDesc);
-		depthBufferShared[index]->CreateRTV(rtvDesc);
 		depthBufferShared[index]->CreateUAV(uavDesc);
 
-		auto& motionVector = rendererData->renderTargets[(uint)RenderTarget::kMotionVectors];
-		D3D11_TEXTURE2D_DESC texDescMotionVector{};
-		reinterpret_cast<ID3D11Texture2D*>(motionVector.texture)->GetDesc(&texDescMotionVector);
-
-		texDesc.Format = texDescMotionVector.Format;
+		texDesc.Format = motionVectorFormat;
 		srvDesc.Format = texDesc.Format;
 		rtvDesc.Format = texDesc.Format;
 		uavDesc.Format = texDesc.Format;
 
+		// The game renders into them with zero-copy motion vectors
+		if (settings.zeroCopyMotionVectors)
+			texDesc.BindFlags |= D3D11_BIND_RENDER_TARGET;
+
 		motionVectorBufferShared[index] = new Texture2D(texDesc);
 		motionVectorBufferShared[index]->CreateSRV(srvDesc);
-		motionVectorBufferShared[index]->CreateRTV(rtvDesc);
+		if (settings.zeroCopyMotionVectors)
+			motionVectorBufferShared[index]->CreateRTV(rtvDesc);
 		motionVectorBufferShared[index]->CreateUAV(uavDesc);
 
-		auto dx12SwapChain = DX12SwapChain::GetSingleton();
+		ShareWithD3D12(depthBufferShared[index], depthBufferShared12[index]);
+		ShareWithD3D12(motionVectorBufferShared[index], motionVectorBufferShared12[index]);
+	}
+
+	if (depthMotionVectorsPacked && dx12SwapChain->swapChain) {
+		ID3D12Resource* packed12[FrameRing::kMaxDepth]{};
+		for (uint32_t index = 0; index < dx12SwapChain->frameRing.GetDepth(); index++)
+			packed12[index] = depthMotionVectorShared12[index].get();
 
-		{
-			IDXGIResource1* dxgiResource = nullptr;
-			DX::ThrowIfFailed(HUDLessBufferShared[index]->resource->QueryInterface(IID_PPV_ARGS(&dxgiResource)));
-
-			if (dx12SwapChain->swapChain) {
-				HANDLE sharedHandle = nullptr;
-				DX::ThrowIfFailed(dxgiResource->CreateSharedHandle(
-					nullptr,
-					DXGI_SHARED_RESOURCE_READ | DXGI_SHARED_RESOURCE_WRITE,
-					nullptr,
-					&sharedHandle));
-
-				DX::ThrowIfFailed(dx12SwapChain->d3d12Device->OpenSharedHandle(
-					sharedHandle,
-					IID_PPV_ARGS(&HUDLessBufferShared12[index])));
-
-				CloseHandle(sharedHandle);
+		DepthMotionVectorUnpack::GetSingleton()->CreateResources(dx12SwapChain->d3d12Device.get(), packed12, dx12SwapChain->frameRing.GetDepth(), motionVectorFormat, dx12SwapChain->stateTracker);
+	}
+
+	// The alpha mask shaders write either the packed texture or the separate ones, converted ones are never copied into
+	static const D3D_SHADER_MACRO packedDefines[] = { { "PACK_DEPTH_MOTION_VECTORS", "1" }, { nullptr, nullptr } };
+	static const D3D_SHADER_MACRO convertedDefines[] = { { "CONVERT_MOTION_VECTORS", "1" }, { nullptr, nullptr } };
+
+	const D3D_SHADER_MACRO* outputDefines = nullptr;
+	if (depthMotionVectorsPacked)
+		outputDefines = packedDefines;
+	else if (motionVectorsConverted)
+		outputDefines = convertedDefines;
+
+	if (settings.alphaMaskMode == AlphaMaskMode::kTiles) {
+		// Sized like the shared inputs, which also bound the render size every dispatch is sized from
+		D3D11_TEXTURE2D_DESC texDesc = HUDLessBufferShared[0]->desc;
+
+		texDesc.Format = DXGI_FORMAT_R16_UINT;
+		texDesc.BindFlags = D3D11_BIND_SHADER_RESOURCE | D3D11_BIND_UNORDERED_ACCESS;
+		texDesc.MiscFlags = 0;
+
+		D3D11_SHADER_RESOURCE_VIEW_DESC srvDesc{};
+		srvDesc.Format = texDesc.Format;
+		srvDesc.ViewDimension = D3D11_SRV_DIMENSION_TEXTURE2D;
+		srvDesc.Texture2D.MipLevels = 1;
+
+		D3D11_UNORDERED_ACCESS_VIEW_DESC uavDesc{};
+		uavDesc.Format = texDesc.Format;
+		uavDesc.ViewDimension = D3D11_UAV_DIMENSION_TEXTURE2D;
+
+		colorHashPreAlpha = new Texture2D(texDesc);
+		colorHashPreAlpha->CreateSRV(srvDesc);
+		colorHashPreAlpha->CreateUAV(uavDesc);
+
+		texDesc.Width = (texDesc.Width + 7) / 8;
+		texDesc.Height = (texDesc.Height + 7) / 8;
+		texDesc.Format = srvDesc.Format = uavDesc.Format = DXGI_FORMAT_R32G32_UINT;
+
+		tileSignaturePreAlpha = new Texture2D(texDesc);
+		tileSignaturePreAlpha->CreateSRV(srvDesc);
+		tileSignaturePreAlpha->CreateUAV(uavDesc);
+
+		uint32_t tileCount = texDesc.Width * texDesc.Height;
+
+		D3D11_BUFFER_DESC bufferDesc{};
+		bufferDesc.ByteWidth = tileCount * sizeof(uint32_t);
+		bufferDesc.Usage = D3D11_USAGE_DEFAULT;
+		bufferDesc.BindFlags = D3D11_BIND_SHADER_RESOURCE | D3D11_BIND_UNORDERED_ACCESS;
+		bufferDesc.MiscFlags = D3D11_RESOURCE_MISC_BUFFER_STRUCTURED;
+		bufferDesc.StructureByteStride = sizeof(uint32_t);
+
+		D3D11_SHADER_RESOURCE_VIEW_DESC bufferSRVDesc{};
+		bufferSRVDesc.Format = DXGI_FORMAT_UNKNOWN;
+		bufferSRVDesc.ViewDimension = D3D11_SRV_DIMENSION_BUFFER;
+		bufferSRVDesc.Buffer.NumElements = tileCount;
+
+		D3D11_UNORDERED_ACCESS_VIEW_DESC bufferUAVDesc{};
+		bufferUAVDesc.Format = DXGI_FORMAT_UNKNOWN;
+		bufferUAVDesc.ViewDimension = D3D11_UAV_DIMENSION_BUFFER;
+		bufferUAVDesc.Buffer.NumElements = tileCount;
+		bufferUAVDesc.Buffer.Flags = D3D11_BUFFER_UAV_FLAG_APPEND;
+
+		alphaTileList = new Buffer(bufferDesc);
+		alphaTileList->CreateSRV(bufferSRVDesc);
+		alphaTileList->CreateUAV(bufferUAVDesc);
+
+		// Group count X is overwritten with the tile count every frame
+		uint32_t args[3] = { 0, 1, 1 };
+		D3D11_SUBRESOURCE_DATA argsData{ args, 0, 0 };
+
+		D3D11_BUFFER_DESC argsDesc{};
+		argsDesc.ByteWidth = sizeof(args);
+		argsDesc.Usage = D3D11_USAGE_DEFAULT;
+		argsDesc.MiscFlags = D3D11_RESOURCE_MISC_DRAWINDIRECT_ARGS;
+
+		alphaTileArgs = new Buffer(argsDesc, &argsData);
+
+		if (!snapshotColorCS)
+			snapshotColorCS = (ID3D11ComputeShader*)CompileShader(L"Data\\F4SE\\Plugins\\FrameGeneration\\SnapshotColorCS.hlsl", "cs_5_0");
+		if (!classifyAlphaTilesCS)
+			classifyAlphaTilesCS = (ID3D11ComputeShader*)CompileShader(L"Data\\F4SE\\Plugins\\FrameGeneration\\ClassifyAlphaTilesCS.hlsl", "cs_5_0");
+		if (!maskAlphaTilesCS)
+			maskAlphaTilesCS = (ID3D11ComputeShader*)CompileShader(L"Data\\F4SE\\Plugins\\FrameGeneration\\MaskAlphaTilesCS.hlsl", "cs_5_0", "main", outputDefines);
+	}
+
+	if (settings.alphaMaskMode == AlphaMaskMode::kStencil) {
+		auto& depth = rendererData->depthStencilTargets[(uint)DepthStencilTarget::kMain];
+		auto depthTexture = reinterpret_cast<ID3D11Texture2D*>(depth.texture);
+
+		D3D11_TEXTURE2D_DESC texDesc{};
+		depthTexture->GetDesc(&texDesc);
+
+		D3D11_SHADER_RESOURCE_VIEW_DESC srvDesc{};
+		srvDesc.ViewDimension = D3D11_SRV_DIMENSION_TEXTURE2D;
+		srvDesc.Texture2D.MipLevels = 1;
+
+		if (texDesc.Format == DXGI_FORMAT_R24G8_TYPELESS)
+			srvDesc.Format = DXGI_FORMAT_X24_TYPELESS_G8_UINT;
+		else if (texDesc.Format == DXGI_FORMAT_R32G8X24_TYPELESS)
+			srvDesc.Format = DXGI_FORMAT_X32_TYPELESS_G8X24_UINT;
+
+		auto device = reinterpret_cast<ID3D11Device*>(rendererData->device);
+
+		if (srvDesc.Format != DXGI_FORMAT_UNKNOWN && SUCCEEDED(device->CreateShaderResourceView(depthTexture, &srvDesc, stencilSRV.put()))) {
+			// Every context call goes through the vtable, only states set inside the alpha window are swapped
+			static bool hooked = [&] {
+				stl::detour_vfunc<36, ID3D11DeviceContext_OMSetDepthStencilState>(rendererData->context);
+				return true;
+			}();
+
+			if (!generateSharedBuffersStencilCS)
+				generateSharedBuffersStencilCS = (ID3D11ComputeShader*)CompileShader(L"Data\\F4SE\\Plugins\\FrameGeneration\\GenerateSharedBuffersStencilCS.hlsl", "cs_5_0", "main", outputDefines);
+			if (!clearStencilBitVS)
+				clearStencilBitVS = (ID3D11VertexShader*)CompileShader(L"Data\\F4SE\\Plugins\\FrameGeneration\\ClearStencilBitVS.hlsl", "vs_5_0");
+
+			if (!clearStencilBitState) {
+				D3D11_DEPTH_STENCIL_DESC dsDesc{};
+				dsDesc.DepthEnable = FALSE;
+				dsDesc.DepthWriteMask = D3D11_DEPTH_WRITE_MASK_ZERO;
+				dsDesc.DepthFunc = D3D11_COMPARISON_ALWAYS;
+				dsDesc.StencilEnable = TRUE;
+				dsDesc.StencilReadMask = D3D11_DEFAULT_STENCIL_READ_MASK;
+				dsDesc.StencilWriteMask = kAlphaStencilBit;
+				dsDesc.FrontFace = { D3D11_STENCIL_OP_KEEP, D3D11_STENCIL_OP_KEEP, D3D11_STENCIL_OP_REPLACE, D3D11_COMPARISON_ALWAYS };
+				dsDesc.BackFace = dsDesc.FrontFace;
+				DX::ThrowIfFailed(device->CreateDepthStencilState(&dsDesc, clearStencilBitState.put()));
+
+				D3D11_RASTERIZER_DESC rsDesc{};
+				rsDesc.FillMode = D3D11_FILL_SOLID;
+				rsDesc.CullMode = D3D11_CULL_NONE;
+				rsDesc.DepthClipEnable = TRUE;
+				DX::ThrowIfFailed(device->CreateRasterizerState(&rsDesc, clearStencilBitRasterizerState.put()));
 			}
+		} else {
+			logger::warn("[Frame Generation] Depth buffer format {} has no readable stencil, falling back to colour difference alpha mask", magic_enum::enum_name(texDesc.Format));
 		}
+	}
 
-		{
-			IDXGIResource1* dxgiResource = nullptr;
-			DX::ThrowIfFailed(depthBufferShared[index]->resource->QueryInterface(IID_PPV_ARGS(&dxgiResource)));
-
-			if (dx12SwapChain->swapChain) {
-				HANDLE sharedHandle = nullptr;
-				DX::ThrowIfFailed(dxgiResource->CreateSharedHandle(
-					nullptr,
-					DXGI_SHARED_RESOURCE_READ | DXGI_SHARED_RESOURCE_WRITE,
-					nullptr,
-					&sharedHandle));
-
-				DX::ThrowIfFailed(dx12SwapChain->d3d12Device->OpenSharedHandle(
-					sharedHandle,
-					IID_PPV_ARGS(&depthBufferShared12[index])));
-
-				CloseHandle(sharedHandle);
-			}
+	if (settings.zeroCopyMotionVectors && depthMotionVectorsPacked) {
+		logger::warn("[Frame Generation] Zero-copy motion vectors are not used with packed depth and motion vectors");
+	} else if (settings.zeroCopyMotionVectors) {
+		auto& texDesc = texDescMotionVector;
+		auto& sharedDesc = motionVectorBufferShared[0]->desc;
+
+		// The colour difference mask would never reach the motion vectors with zero-copy, ENB may hold on to the game's views
+		if (enbLoaded)
+			logger::warn("[Frame Generation] Zero-copy motion vectors are not used with ENB, copying instead");
+		else if (settings.alphaMaskMode == AlphaMaskMode::kColorDifference)
+			logger::warn("[Frame Generation] Zero-copy motion vectors need iAlphaMaskMode 1 or 2, copying instead");
+		else if (texDesc.Width != sharedDesc.Width || texDesc.Height != sharedDesc.Height || texDesc.Format != sharedDesc.Format)
+			logger::warn("[Frame Generation] Motion vectors are {}x{} {}, not the shared size and format, copying instead", texDesc.Width, texDesc.Height, magic_enum::enum_name(texDesc.Format));
+		else
+			motionVectorsZeroCopy = true;
+
+		// Kept so the game's own target can be put back when the shared textures go away
+		if (motionVectorsZeroCopy && !gameMotionVectorTexture) {
+			gameMotionVectorTexture = reinterpret_cast<ID3D11Texture2D*>(motionVector.texture);
+			gameMotionVectorRTV = reinterpret_cast<ID3D11RenderTargetView*>(motionVector.rtView);
+			gameMotionVectorSRV = reinterpret_cast<ID3D11ShaderResourceView*>(motionVector.srView);
+
+			gameMotionVectorTexture->AddRef();
+			gameMotionVectorRTV->AddRef();
+			gameMotionVectorSRV->AddRef();
 		}
 
-		{
-			IDXGIResource1* dxgiResource = nullptr;
-			DX::ThrowIfFailed(motionVectorBufferShared[index]->resource->QueryInterface(IID_PPV_ARGS(&dxgiResource)));
-
-			if (dx12SwapChain->swapChain) {
-				HANDLE sharedHandle = nullptr;
-				DX::ThrowIfFailed(dxgiResource->CreateSharedHandle(
-					nullptr,
-					DXGI_SHARED_RESOURCE_READ | DXGI_SHARED_RESOURCE_WRITE,
-					nullptr,
-					&sharedHandle));
-
-				DX::ThrowIfFailed(dx12SwapChain->d3d12Device->OpenSharedHandle(
-					sharedHandle,
-					IID_PPV_ARGS(&motionVectorBufferShared12[index])));
-
-				CloseHandle(sharedHandle);
-			}
+		// The masks must not write into the game's live target, later game passes still read it
+		if (motionVectorsZeroCopy) {
+			static const D3D_SHADER_MACRO depthOnlyDefines[] = { { "MASK_DEPTH_ONLY", "1" }, { nullptr, nullptr } };
+
+			if (!generateSharedBuffersDepthOnlyCS)
+				generateSharedBuffersDepthOnlyCS = (ID3D11ComputeShader*)CompileShader(L"Data\\F4SE\\Plugins\\FrameGeneration\\GenerateSharedBuffersCS.hlsl", "cs_5_0", "main", depthOnlyDefines);
+			if (!generateSharedBuffersStencilDepthOnlyCS && stencilSRV)
+				generateSharedBuffersStencilDepthOnlyCS = (ID3D11ComputeShader*)CompileShader(L"Data\\F4SE\\Plugins\\FrameGeneration\\GenerateSharedBuffersStencilCS.hlsl", "cs_5_0", "main", depthOnlyDefines);
+			if (!maskAlphaTilesDepthOnlyCS && settings.alphaMaskMode == AlphaMaskMode::kTiles)
+				maskAlphaTilesDepthOnlyCS = (ID3D11ComputeShader*)CompileShader(L"Data\\F4SE\\Plugins\\FrameGeneration\\MaskAlphaTilesCS.hlsl", "cs_5_0", "main", depthOnlyDefines);
+		}
+	}
+
+	if (!copyDepthToSharedBufferCS)
+		copyDepthToSharedBufferCS = (ID3D11ComputeShader*)CompileShader(L"Data\\F4SE\\Plugins\\FrameGeneration\\CopyDepthToSharedBufferCS.hlsl", "cs_5_0");
+	if (!copyDepthMotionVectorsCS && (depthMotionVectorsPacked || motionVectorsConverted))
+		copyDepthMotionVectorsCS = (ID3D11ComputeShader*)CompileShader(L"Data\\F4SE\\Plugins\\FrameGeneration\\CopyDepthMotionVectorsCS.hlsl", "cs_5_0", "main", outputDefines);
+	if (!generateSharedBuffersCS)
+		generateSharedBuffersCS = (ID3D11ComputeShader*)CompileShader(L"Data\\F4SE\\Plugins\\FrameGeneration\\GenerateSharedBuffersCS.hlsl", "cs_5_0", "main", outputDefines);
+
+	// Both precisions come from the same unmasked game data, so a capture pair differs by the format alone
+	if (settings.captureInterval) {
+		auto Typed = [](DXGI_FORMAT a_format) {
+			return a_format == DXGI_FORMAT_R32G32_TYPELESS ? DXGI_FORMAT_R32G32_FLOAT : a_format;
+		};
+
+		DXGI_FORMAT depthFormats[2] = { DXGI_FORMAT_R32_FLOAT, depthMotionVectorsPacked ? DXGI_FORMAT_R32_FLOAT : depthFormat };
+		DXGI_FORMAT motionVectorFormats[2] = { DXGI_FORMAT_R32G32_FLOAT, Typed(motionVectorFormat) };
+
+		D3D11_TEXTURE2D_DESC texDesc = HUDLessBufferShared[0]->desc;
+		texDesc.BindFlags = D3D11_BIND_SHADER_RESOURCE | D3D11_BIND_UNORDERED_ACCESS;
+		texDesc.MiscFlags = 0;
+
+		D3D11_UNORDERED_ACCESS_VIEW_DESC uavDesc{};
+		uavDesc.ViewDimension = D3D11_UAV_DIMENSION_TEXTURE2D;
+
+		for (uint32_t precision = 0; precision < 2; precision++) {
+			texDesc.Format = uavDesc.Format = depthFormats[precision];
+			captureDepth[precision] = new Texture2D(texDesc);
+			captureDepth[precision]->CreateUAV(uavDesc);
+
+			texDesc.Format = uavDesc.Format = motionVectorFormats[precision];
+			captureMotionVectors[precision] = new Texture2D(texDesc);
+			captureMotionVectors[precision]->CreateUAV(uavDesc);
+		}
+
+		// Without defines it writes separate depth and motion vectors, the UAV format does the conversion
+		if (!captureDepthMotionVectorsCS)
+			captureDepthMotionVectorsCS = (ID3D11ComputeShader*)CompileShader(L"Data\\F4SE\\Plugins\\FrameGeneration\\CopyDepthMotionVectorsCS.hlsl", "cs_5_0");
+	}
+}
+
+void Upscaling::ReleaseFrameGenerationResources()
+{
+	logger::info("[Frame Generation] Releasing resources");
+
+	auto dx12SwapChain = DX12SwapChain::GetSingleton();
+
+	// The game must not keep rendering into a texture that is about to be released
+	ReleaseGameMotionVectors();
+
+	inputsWritten = false;
+	HUDLessWritten = false;
+
+	for (uint32_t index = 0; index < FrameRing::kMaxDepth; index++) {
+		for (auto resource12 : { &HUDLessBufferShared12[index], &depthBufferShared12[index], &motionVectorBufferShared12[index], &depthMotionVectorShared12[index] }) {
+			if (*resource12)
+				dx12SwapChain->stateTracker.Untrack(resource12->get());
+			*resource12 = nullptr;
 		}
+
+		delete HUDLessBufferShared[index];
+		delete depthBufferShared[index];
+		delete motionVectorBufferShared[index];
+		delete depthMotionVectorShared[index];
+
+		HUDLessBufferShared[index] = nullptr;
+		depthBufferShared[index] = nullptr;
+		motionVectorBufferShared[index] = nullptr;
+		depthMotionVectorShared[index] = nullptr;
+	}
+
+	DepthMotionVectorUnpack::GetSingleton()->ReleaseResources(dx12SwapChain->stateTracker);
+
+	for (uint32_t precision = 0; precision < 2; precision++) {
+		delete captureDepth[precision];
+		delete captureMotionVectors[precision];
+
+		captureDepth[precision] = nullptr;
+		captureMotionVectors[precision] = nullptr;
 	}
 
-	copyDepthToSharedBufferCS = (ID3D11ComputeShader*)CompileShader(L"Data\\F4SE\\Plugins\\FrameGeneration\\CopyDepthToSharedBufferCS.hlsl", "cs_5_0");	
-	generateSharedBuffersCS = (ID3D11ComputeShader*)CompileShader(L"Data\\F4SE\\Plugins\\FrameGeneration\\GenerateSharedBuffersCS.hlsl", "cs_5_0");
+	delete colorHashPreAlpha;
+	delete tileSignaturePreAlpha;
+	delete alphaTileList;
+	delete alphaTileArgs;
+
+	stencilSRV = nullptr;
+	alphaStencilView = nullptr;
+
+	colorHashPreAlpha = nullptr;
+	tileSignaturePreAlpha = nullptr;
+	alphaTileList = nullptr;
+	alphaTileArgs = nullptr;
 }
 
 void Upscaling::PreAlpha()
 {
+	ZoneScoped;
+
 	auto rendererData = RE::BSGraphics::RendererData::GetSingleton();
 	auto context = reinterpret_cast<ID3D11DeviceContext*>(rendererData->context);
 	
 	auto& colorMain = rendererData->renderTargets[(uint)RenderTarget::kMain];
 	auto& colorPostAlpha = rendererData->renderTargets[(uint)RenderTarget::kMainTemp];
 
-	context->CopyResource(reinterpret_cast<ID3D11Texture2D*>(colorMain.texture), reinterpret_cast<ID3D11Texture2D*>(colorPostAlpha.texture));
+	auto gpuProfiler = GPUProfiler::GetSingleton();
+
+	if (d3d12Interop && settings.alphaMaskMode != AlphaMaskMode::kColorDifference && !setupBuffers)
+		CreateFrameGenerationResources();
+
+	// Alpha draws mark themselves, nothing to copy unless a recent frame had draws the stencil could not mark
+	alphaStencilColorCopy = false;
+	if (d3d12Interop && settings.alphaMaskMode == AlphaMaskMode::kStencil && BeginAlphaStencil(context)) {
+		if (!alphaStencilFallbackFrames)
+			return;
+		alphaStencilColorCopy = true;
+	}
+
+	if (!d3d12Interop || settings.alphaMaskMode != AlphaMaskMode::kTiles) {
+		gpuProfiler->Begin(GPUProfiler::Pass::kPreAlpha);
+		CopyRenderRegion(context, reinterpret_cast<ID3D11Texture2D*>(colorMain.texture), reinterpret_cast<ID3D11Texture2D*>(colorPostAlpha.texture));
+		gpuProfiler->End(GPUProfiler::Pass::kPreAlpha);
+		return;
+	}
+
+	// Only a 16-bit hash per pixel and a signature per tile are kept for the comparison after alpha
+	auto renderSize = GetRenderSize();
+	uint32_t dispatchX = (uint32_t)std::ceil(float(renderSize.width) / 8.0f);
+	uint32_t dispatchY = (uint32_t)std::ceil(float(renderSize.height) / 8.0f);
+
+	ID3D11ShaderResourceView* views[1] = { reinterpret_cast<ID3D11ShaderResourceView*>(colorPostAlpha.srView) };
+	context->CSSetShaderResources(0, ARRAYSIZE(views), views);
+
+	ID3D11UnorderedAccessView* uavs[2] = { colorHashPreAlpha->uav.get(), tileSignaturePreAlpha->uav.get() };
+	context->CSSetUnorderedAccessViews(0, ARRAYSIZE(uavs), uavs, nullptr);
+
+	context->CSSetShader(snapshotColorCS, nullptr, 0);
+
+	gpuProfiler->Begin(GPUProfiler::Pass::kSnapshotColor);
+	context->Dispatch(dispatchX, dispatchY, 1);
+	gpuProfiler->End(GPUProfiler::Pass::kSnapshotColor);
+
+	views[0] = nullptr;
+	context->CSSetShaderResources(0, ARRAYSIZE(views), views);
+
+	uavs[0] = uavs[1] = nullptr;
+	context->CSSetUnorderedAccessViews(0, ARRAYSIZE(uavs), uavs, nullptr);
+
+	ID3D11ComputeShader* shader = nullptr;
+	context->CSSetShader(shader, nullptr, 0);
 }
 
 void Upscaling::PostAlpha()
 {
+	ZoneScoped;
+
 	if (!d3d12Interop)
 		return;
 
+	Telemetry::GetSingleton()->Mark(Telemetry::Event::kPostAlpha);
+
 	if (!setupBuffers)
 		CreateFrameGenerationResources();
 
@@ -290,8 +739,83 @@ void Upscaling::PostAlpha()
 	auto context = reinterpret_cast<ID3D11DeviceContext*>(rendererData->context);
 	auto dx12SwapChain = DX12SwapChain::GetSingleton();
 
+	// Restores the game's state before its render targets are unbound
+	bool stencilMask = alphaStencilActive;
+	if (stencilMask) {
+		EndAlphaStencil(context);
+
+		if (alphaStencilConflict) {
+			if (!alphaStencilFallbackFrames)
+				logger::info("[Frame Generation] Alpha draws already use the stencil, using the colour difference alpha mask for the next {} frames", kAlphaStencilFallbackFrames);
+			alphaStencilFallbackFrames = kAlphaStencilFallbackFrames;
+		} else if (alphaStencilFallbackFrames) {
+			alphaStencilFallbackFrames--;
+		}
+	}
+
 	context->OMSetRenderTargets(0, nullptr, nullptr);
 
+	// Every path below writes the whole render region
+	inputsWritten = true;
+
+	if (settings.alphaMaskMode == AlphaMaskMode::kTiles) {
+		MaskAlphaTiles();
+		return;
+	}
+
+	auto gpuProfiler = GPUProfiler::GetSingleton();
+
+	if (stencilMask && !alphaStencilColorCopy) {
+		auto& motionVector = rendererData->renderTargets[(uint)RenderTarget::kMotionVectors];
+		auto& depth = rendererData->depthStencilTargets[(uint)DepthStencilTarget::kMain];
+
+		// Packed or converted outputs are written whole, so the motion vectors are read by the dispatch instead of copied first
+		bool readMotionVectors = depthMotionVectorsPacked || motionVectorsConverted;
+
+		// Otherwise only the marked pixels are rewritten, the rest is whatever the game rendered
+		if (!readMotionVectors && !MotionVectorsShared()) {
+			gpuProfiler->Begin(GPUProfiler::Pass::kCopyMotionVectors);
+			CopyRenderRegion(context, motionVectorBufferShared[dx12SwapChain->frameIndex]->resource.get(), reinterpret_cast<ID3D11Texture2D*>(motionVector.texture));
+			gpuProfiler->End(GPUProfiler::Pass::kCopyMotionVectors);
+		}
+
+		auto renderSize = GetRenderSize();
+		uint32_t dispatchX = (uint32_t)std::ceil(float(renderSize.width) / 8.0f);
+		uint32_t dispatchY = (uint32_t)std::ceil(float(renderSize.height) / 8.0f);
+
+		ID3D11ShaderResourceView* views[3] = {
+			reinterpret_cast<ID3D11ShaderResourceView*>(depth.srViewDepth),
+			stencilSRV.get(),
+			reinterpret_cast<ID3D11ShaderResourceView*>(motionVector.srView)
+		};
+		context->CSSetShaderResources(0, readMotionVectors ? 3 : 2, views);
+
+		ID3D11UnorderedAccessView* uavs[2]{};
+		context->CSSetUnorderedAccessViews(0, GetSharedOutputUAVs(uavs), uavs, nullptr);
+
+		context->CSSetShader(MotionVectorsShared() ? generateSharedBuffersStencilDepthOnlyCS : generateSharedBuffersStencilCS, nullptr, 0);
+
+		gpuProfiler->Begin(GPUProfiler::Pass::kGenerateSharedBuffers);
+		context->Dispatch(dispatchX, dispatchY, 1);
+		gpuProfiler->End(GPUProfiler::Pass::kGenerateSharedBuffers);
+
+		ID3D11ShaderResourceView* nullViews[3] = { nullptr, nullptr, nullptr };
+		context->CSSetShaderResources(0, ARRAYSIZE(nullViews), nullViews);
+
+		ID3D11UnorderedAccessView* nullUavs[2] = { nullptr, nullptr };
+		context->CSSetUnorderedAccessViews(0, ARRAYSIZE(nullUavs), nullUavs, nullptr);
+
+		ID3D11ComputeShader* shader = nullptr;
+		context->CSSetShader(shader, nullptr, 0);
+
+		ClearAlphaStencil(context);
+		return;
+	}
+
+	// The marks are not read when the colour was copied before alpha
+	if (stencilMask)
+		ClearAlphaStencil(context);
+
 	{
 		auto& colorPreAlpha = rendererData->renderTargets[(uint)RenderTarget::kMain];
 		auto& colorPostAlpha = rendererData->renderTargets[(uint)RenderTarget::kMainTemp];
@@ -299,25 +823,31 @@ void Upscaling::PostAlpha()
 		auto& motionVector = rendererData->renderTargets[(uint)RenderTarget::kMotionVectors];
 		auto& depth = rendererData->depthStencilTargets[(uint)DepthStencilTarget::kMain];
 
+		// A stencil fallback frame with zero-copy only masks depth, the motion vectors are the game's live target
+		bool depthOnly = MotionVectorsShared();
+
 		{
-			uint32_t dispatchX = (uint32_t)std::ceil(float(dx12SwapChain->swapChainDesc.Width) / 8.0f);
-			uint32_t dispatchY = (uint32_t)std::ceil(float(dx12SwapChain->swapChainDesc.Height) / 8.0f);
+			auto renderSize = GetRenderSize();
+			uint32_t dispatchX = (uint32_t)std::ceil(float(renderSize.width) / 8.0f);
+			uint32_t dispatchY = (uint32_t)std::ceil(float(renderSize.height) / 8.0f);
 
 			ID3D11ShaderResourceView* views[4] = { 
 				reinterpret_cast<ID3D11ShaderResourceView*>(colorPreAlpha.srView),
 				reinterpret_cast<ID3D11ShaderResourceView*>(colorPostAlpha.srView),
-				reinterpret_cast<ID3D11ShaderResourceView*>(motionVector.srView),
+				depthOnly ? nullptr : reinterpret_cast<ID3D11ShaderResourceView*>(motionVector.srView),
 				reinterpret_cast<ID3D11ShaderResourceView*>(depth.srViewDepth)
 			};
 
 			context->CSSetShaderResources(0, ARRAYSIZE(views), views);
 
-			ID3D11UnorderedAccessView* uavs[2] = { motionVectorBufferShared[dx12SwapChain->frameIndex]->uav.get(), depthBufferShared[dx12SwapChain->frameIndex]->uav.get()};
-			context->CSSetUnorderedAccessViews(0, ARRAYSIZE(uavs), uavs, nullptr);
+			ID3D11UnorderedAccessView* uavs[2]{};
+			context->CSSetUnorderedAccessViews(0, GetSharedOutputUAVs(uavs), uavs, nullptr);
 
-			context->CSSetShader(generateSharedBuffersCS, nullptr, 0);
+			context->CSSetShader(depthOnly ? generateSharedBuffersDepthOnlyCS : generateSharedBuffersCS, nullptr, 0);
 
+			gpuProfiler->Begin(GPUProfiler::Pass::kGenerateSharedBuffers);
 			context->Dispatch(dispatchX, dispatchY, 1);
+			gpuProfiler->End(GPUProfiler::Pass::kGenerateSharedBuffers);
 		}
 
 		ID3D11ShaderResourceView* views[3] = { nullptr, nullptr, nullptr };
@@ -333,28 +863,84 @@ void Upscaling::PostAlpha()
 
 void Upscaling::CopyBuffersToSharedResources()
 {
+	ZoneScoped;
+
 	if (!d3d12Interop)
 		return;
 
+	Telemetry::GetSingleton()->Mark(Telemetry::Event::kCopyBuffersToSharedResources);
+
 	if (!setupBuffers)
 		CreateFrameGenerationResources();
 
 	auto rendererData = RE::BSGraphics::RendererData::GetSingleton();
+	auto context = reinterpret_cast<ID3D11DeviceContext*>(rendererData->context);
+
+	context->OMSetRenderTargets(0, nullptr, nullptr);
+
+	inputsWritten = true;
+	CopyMotionVectorsAndDepth();
+}
+
+void Upscaling::CopyMotionVectorsAndDepth()
+{
+	auto rendererData = RE::BSGraphics::RendererData::GetSingleton();
 
 	auto context = reinterpret_cast<ID3D11DeviceContext*>(rendererData->context);
 	auto dx12SwapChain = DX12SwapChain::GetSingleton();
-	
-	context->OMSetRenderTargets(0, nullptr, nullptr);
 
-	auto& motionVector = rendererData->renderTargets[(uint)RenderTarget::kMotionVectors];
-	context->CopyResource(motionVectorBufferShared[dx12SwapChain->frameIndex]->resource.get(), reinterpret_cast<ID3D11Texture2D*>(motionVector.texture));
+	auto gpuProfiler = GPUProfiler::GetSingleton();
+
+	// One dispatch does both when the motion vectors cannot simply be copied
+	if (depthMotionVectorsPacked || motionVectorsConverted) {
+		auto& motionVector = rendererData->renderTargets[(uint)RenderTarget::kMotionVectors];
+		auto& depth = rendererData->depthStencilTargets[(uint)DepthStencilTarget::kMain];
+
+		auto renderSize = GetRenderSize();
+		uint32_t dispatchX = (uint32_t)std::ceil(float(renderSize.width) / 8.0f);
+		uint32_t dispatchY = (uint32_t)std::ceil(float(renderSize.height) / 8.0f);
+
+		ID3D11ShaderResourceView* views[2] = {
+			reinterpret_cast<ID3D11ShaderResourceView*>(depth.srViewDepth),
+			reinterpret_cast<ID3D11ShaderResourceView*>(motionVector.srView)
+		};
+		context->CSSetShaderResources(0, ARRAYSIZE(views), views);
+
+		ID3D11UnorderedAccessView* uavs[2]{};
+		context->CSSetUnorderedAccessViews(0, GetSharedOutputUAVs(uavs), uavs, nullptr);
+
+		context->CSSetShader(copyDepthMotionVectorsCS, nullptr, 0);
+
+		gpuProfiler->Begin(GPUProfiler::Pass::kCopyDepthMotionVectors);
+		context->Dispatch(dispatchX, dispatchY, 1);
+		gpuProfiler->End(GPUProfiler::Pass::kCopyDepthMotionVectors);
+
+		ID3D11ShaderResourceView* nullViews[2] = { nullptr, nullptr };
+		context->CSSetShaderResources(0, ARRAYSIZE(nullViews), nullViews);
+
+		ID3D11UnorderedAccessView* nullUavs[2] = { nullptr, nullptr };
+		context->CSSetUnorderedAccessViews(0, ARRAYSIZE(nullUavs), nullUavs, nullptr);
+
+		ID3D11ComputeShader* shader = nullptr;
+		context->CSSetShader(shader, nullptr, 0);
+		return;
+	}
+
+	// Already in place when the game rendered straight into the shared texture
+	if (!MotionVectorsShared()) {
+		auto& motionVector = rendererData->renderTargets[(uint)RenderTarget::kMotionVectors];
+		gpuProfiler->Begin(GPUProfiler::Pass::kCopyMotionVectors);
+		CopyRenderRegion(context, motionVectorBufferShared[dx12SwapChain->frameIndex]->resource.get(), reinterpret_cast<ID3D11Texture2D*>(motionVector.texture));
+		gpuProfiler->End(GPUProfiler::Pass::kCopyMotionVectors);
+	}
 		
 	{
 		auto& depth = rendererData->depthStencilTargets[(uint)DepthStencilTarget::kMain];
 
 		{
-			uint32_t dispatchX = (uint32_t)std::ceil(float(dx12SwapChain->swapChainDesc.Width) / 8.0f);
-			uint32_t dispatchY = (uint32_t)std::ceil(float(dx12SwapChain->swapChainDesc.Height) / 8.0f);
+			auto renderSize = GetRenderSize();
+			uint32_t dispatchX = (uint32_t)std::ceil(float(renderSize.width) / 8.0f);
+			uint32_t dispatchY = (uint32_t)std::ceil(float(renderSize.height) / 8.0f);
 
 
 			ID3D11ShaderResourceView* views[1] = { reinterpret_cast<ID3D11ShaderResourceView*>(depth.srViewDepth) };
@@ -365,7 +951,9 @@ void Upscaling::CopyBuffersToSharedResources()
 
 			context->CSSetShader(copyDepthToSharedBufferCS, nullptr, 0);
 
+			gpuProfiler->Begin(GPUProfiler::Pass::kCopyDepth);
 			context->Dispatch(dispatchX, dispatchY, 1);
+			gpuProfiler->End(GPUProfiler::Pass::kCopyDepth);
 		}
 
 		ID3D11ShaderResourceView* views[1] = { nullptr };
@@ -379,124 +967,363 @@ void Upscaling::CopyBuffersToSharedResources()
 	}	
 }
 
-void Upscaling::TimerSleepQPC(int64_t targetQPC)
+void Upscaling::MaskAlphaTiles()
 {
-	LARGE_INTEGER currentQPC;
-	do {
-		QueryPerformanceCounter(&currentQPC);
-	} while (currentQPC.QuadPart < targetQPC);
+	auto rendererData = RE::BSGraphics::RendererData::GetSingleton();
+
+	auto context = reinterpret_cast<ID3D11DeviceContext*>(rendererData->context);
+
+	auto& colorPostAlpha = rendererData->renderTargets[(uint)RenderTarget::kMainTemp];
+
+	auto gpuProfiler = GPUProfiler::GetSingleton();
+
+	// Find the tiles whose colour alpha changed
+	{
+		auto renderSize = GetRenderSize();
+		uint32_t dispatchX = (uint32_t)std::ceil(float(renderSize.width) / 8.0f);
+		uint32_t dispatchY = (uint32_t)std::ceil(float(renderSize.height) / 8.0f);
+
+		ID3D11ShaderResourceView* views[2] = {
+			reinterpret_cast<ID3D11ShaderResourceView*>(colorPostAlpha.srView),
+			tileSignaturePreAlpha->srv.get()
+		};
+		context->CSSetShaderResources(0, ARRAYSIZE(views), views);
+
+		// The append counter starts from zero every frame
+		ID3D11UnorderedAccessView* uavs[1] = { alphaTileList->uav.get() };
+		UINT initialCounts[1] = { 0 };
+		context->CSSetUnorderedAccessViews(0, ARRAYSIZE(uavs), uavs, initialCounts);
+
+		context->CSSetShader(classifyAlphaTilesCS, nullptr, 0);
+
+		gpuProfiler->Begin(GPUProfiler::Pass::kClassifyAlphaTiles);
+		context->Dispatch(dispatchX, dispatchY, 1);
+		gpuProfiler->End(GPUProfiler::Pass::kClassifyAlphaTiles);
+
+		context->CopyStructureCount(alphaTileArgs->resource.get(), 0, alphaTileList->uav.get());
+
+		ID3D11ShaderResourceView* nullViews[2] = { nullptr, nullptr };
+		context->CSSetShaderResources(0, ARRAYSIZE(nullViews), nullViews);
+
+		ID3D11UnorderedAccessView* nullUavs[1] = { nullptr };
+		context->CSSetUnorderedAccessViews(0, ARRAYSIZE(nullUavs), nullUavs, nullptr);
+	}
+
+	// Untouched pixels are plain copies
+	CopyMotionVectorsAndDepth();
+
+	// Mask only the classified tiles
+	{
+		auto& depth = rendererData->depthStencilTargets[(uint)DepthStencilTarget::kMain];
+
+		ID3D11ShaderResourceView* views[4] = {
+			alphaTileList->srv.get(),
+			reinterpret_cast<ID3D11ShaderResourceView*>(colorPostAlpha.srView),
+			colorHashPreAlpha->srv.get(),
+			reinterpret_cast<ID3D11ShaderResourceView*>(depth.srViewDepth)
+		};
+		context->CSSetShaderResources(0, ARRAYSIZE(views), views);
+
+		ID3D11UnorderedAccessView* uavs[2]{};
+		context->CSSetUnorderedAccessViews(0, GetSharedOutputUAVs(uavs), uavs, nullptr);
+
+		context->CSSetShader(MotionVectorsShared() ? maskAlphaTilesDepthOnlyCS : maskAlphaTilesCS, nullptr, 0);
+
+		gpuProfiler->Begin(GPUProfiler::Pass::kMaskAlphaTiles);
+		context->DispatchIndirect(alphaTileArgs->resource.get(), 0);
+		gpuProfiler->End(GPUProfiler::Pass::kMaskAlphaTiles);
+
+		ID3D11ShaderResourceView* nullViews[4] = { nullptr, nullptr, nullptr, nullptr };
+		context->CSSetShaderResources(0, ARRAYSIZE(nullViews), nullViews);
+
+		ID3D11UnorderedAccessView* nullUavs[2] = { nullptr, nullptr };
+		context->CSSetUnorderedAccessViews(0, ARRAYSIZE(nullUavs), nullUavs, nullptr);
+
+		ID3D11ComputeShader* shader = nullptr;
+		context->CSSetShader(shader, nullptr, 0);
+	}
 }
 
-void Upscaling::FrameLimiter(bool a_useFrameGeneration)
+UINT Upscaling::GetSharedOutputUAVs(ID3D11UnorderedAccessView** a_uavs)
 {
-	static LARGE_INTEGER lastFrame = {};
+	auto frameIndex = DX12SwapChain::GetSingleton()->frameIndex;
 
-	if (d3d12Interop && settings.frameLimitMode) {
+	if (depthMotionVectorsPacked) {
+		a_uavs[0] = depthMotionVectorShared[frameIndex]->uav.get();
+		return 1;
+	}
+
+	// The game's live motion vectors are never bound for writing
+	a_uavs[0] = MotionVectorsShared() ? nullptr : motionVectorBufferShared[frameIndex]->uav.get();
+	a_uavs[1] = depthBufferShared[frameIndex]->uav.get();
+	return 2;
+}
+
+Upscaling::RenderSize Upscaling::GetRenderSize()
+{
+	static auto gameViewport = State_GetSingleton();
+	static auto renderTargetManager = RenderTargetManager_GetSingleton();
+
+	auto dx12SwapChain = DX12SwapChain::GetSingleton();
+	auto& renderSize = renderSizes[dx12SwapChain->frameIndex];
+
+	// The game can change the scale while the frame is still being recorded or presented
+	if (renderSizeMeasured && d3d12Interop)
+		return renderSize;
+
+	float widthRatio = renderTargetManager->dynamicWidthRatio;
+	float heightRatio = renderTargetManager->dynamicHeightRatio;
+
+	// Rounded up so a partly covered edge pixel is still included
+	auto width = (uint32_t)std::ceil(float(gameViewport->screenWidth) * widthRatio);
+	auto height = (uint32_t)std::ceil(float(gameViewport->screenHeight) * heightRatio);
+
+	// FSR takes at most the display size, the passes and the tile list at most the shared inputs' size
+	auto maxWidth = dx12SwapChain->swapChainDesc.Width;
+	auto maxHeight = dx12SwapChain->swapChainDesc.Height;
+
+	if (HUDLessBufferShared[0]) {
+		maxWidth = std::min(maxWidth, HUDLessBufferShared[0]->desc.Width);
+		maxHeight = std::min(maxHeight, HUDLessBufferShared[0]->desc.Height);
+	}
 
-		// Stick within VRR bounds
-		double bestRefreshRate = refreshRate - (refreshRate * refreshRate) / 3600.0;
+	renderSize = { std::clamp(width, 1u, maxWidth), std::clamp(height, 1u, maxHeight), widthRatio, heightRatio };
+	renderSizeMeasured = true;
+	return renderSize;
+}
 
-		LARGE_INTEGER qpf;
-		QueryPerformanceFrequency(&qpf);
+void Upscaling::CopyRenderRegion(ID3D11DeviceContext* a_context, ID3D11Resource* a_destination, ID3D11Resource* a_source)
+{
+	auto renderSize = GetRenderSize();
 
-		int64_t targetFrameTicks = int64_t(double(qpf.QuadPart) / (bestRefreshRate * (a_useFrameGeneration ? 0.5 : 1.0)));
+	D3D11_BOX box{ 0, 0, 0, renderSize.width, renderSize.height, 1 };
+	a_context->CopySubresourceRegion(a_destination, 0, 0, 0, 0, a_source, 0, &box);
+}
 
-		LARGE_INTEGER timeNow;
-		QueryPerformanceCounter(&timeNow);
-		int64_t delta = timeNow.QuadPart - lastFrame.QuadPart;
-		if (delta < targetFrameTicks) {
-			TimerSleepQPC(lastFrame.QuadPart + targetFrameTicks);
+bool Upscaling::BeginAlphaStencil(ID3D11DeviceContext* a_context)
+{
+	if (!stencilSRV || !generateSharedBuffersStencilCS || !clearStencilBitVS)
+		return false;
+
+	// Stencil writes are not allowed through a read-only view, fall back for this frame
+	winrt::com_ptr<ID3D11DepthStencilView> depthStencilView;
+	a_context->OMGetRenderTargets(0, nullptr, depthStencilView.put());
+	if (!depthStencilView)
+		return false;
+
+	D3D11_DEPTH_STENCIL_VIEW_DESC dsvDesc{};
+	depthStencilView->GetDesc(&dsvDesc);
+	if (dsvDesc.Flags & D3D11_DSV_READ_ONLY_STENCIL)
+		return false;
+
+	ID3D11DepthStencilState* state = nullptr;
+	UINT stencilRef = 0;
+	a_context->OMGetDepthStencilState(&state, &stencilRef);
+
+	// Goes through the hook, so the state already bound is swapped too
+	alphaStencilView = depthStencilView;
+	alphaStencilConflict = false;
+	alphaStencilActive = true;
+	a_context->OMSetDepthStencilState(state, stencilRef);
+
+	if (state)
+		state->Release();
+
+	return true;
+}
+
+void Upscaling::EndAlphaStencil(ID3D11DeviceContext* a_context)
+{
+	alphaStencilActive = false;
+	a_context->OMSetDepthStencilState(gameDepthStencilState, gameStencilRef);
+}
+
+void Upscaling::ClearAlphaStencil(ID3D11DeviceContext* a_context)
+{
+	if (!alphaStencilView)
+		return;
+
+	// Everything touched is put back, the game's state cache still assumes its own
+	D3D11_PRIMITIVE_TOPOLOGY topology{};
+	a_context->IAGetPrimitiveTopology(&topology);
+	winrt::com_ptr<ID3D11InputLayout> inputLayout;
+	a_context->IAGetInputLayout(inputLayout.put());
+
+	winrt::com_ptr<ID3D11VertexShader> vertexShader;
+	a_context->VSGetShader(vertexShader.put(), nullptr, nullptr);
+	winrt::com_ptr<ID3D11HullShader> hullShader;
+	a_context->HSGetShader(hullShader.put(), nullptr, nullptr);
+	winrt::com_ptr<ID3D11DomainShader> domainShader;
+	a_context->DSGetShader(domainShader.put(), nullptr, nullptr);
+	winrt::com_ptr<ID3D11GeometryShader> geometryShader;
+	a_context->GSGetShader(geometryShader.put(), nullptr, nullptr);
+	winrt::com_ptr<ID3D11PixelShader> pixelShader;
+	a_context->PSGetShader(pixelShader.put(), nullptr, nullptr);
+
+	winrt::com_ptr<ID3D11RasterizerState> rasterizerState;
+	a_context->RSGetState(rasterizerState.put());
+	D3D11_VIEWPORT viewports[D3D11_VIEWPORT_AND_SCISSORRECT_OBJECT_COUNT_PER_PIPELINE]{};
+	UINT viewportCount = ARRAYSIZE(viewports);
+	a_context->RSGetViewports(&viewportCount, viewports);
+
+	winrt::com_ptr<ID3D11DepthStencilState> depthStencilState;
+	UINT stencilRef = 0;
+	a_context->OMGetDepthStencilState(depthStencilState.put(), &stencilRef);
+
+	auto renderSize = GetRenderSize();
+	D3D11_VIEWPORT viewport{ 0.0f, 0.0f, (float)renderSize.width, (float)renderSize.height, 0.0f, 1.0f };
+
+	a_context->IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
+	a_context->IASetInputLayout(nullptr);
+	a_context->VSSetShader(clearStencilBitVS, nullptr, 0);
+	a_context->HSSetShader(nullptr, nullptr, 0);
+	a_context->DSSetShader(nullptr, nullptr, 0);
+	a_context->GSSetShader(nullptr, nullptr, 0);
+	a_context->PSSetShader(nullptr, nullptr, 0);
+	a_context->RSSetState(clearStencilBitRasterizerState.get());
+	a_context->RSSetViewports(1, &viewport);
+	a_context->OMSetDepthStencilState(clearStencilBitState.get(), 0);
+	a_context->OMSetRenderTargets(0, nullptr, alphaStencilView.get());
+
+	a_context->Draw(3, 0);
+
+	a_context->OMSetRenderTargets(0, nullptr, nullptr);
+	a_context->OMSetDepthStencilState(depthStencilState.get(), stencilRef);
+	a_context->RSSetViewports(viewportCount, viewports);
+	a_context->RSSetState(rasterizerState.get());
+	a_context->PSSetShader(pixelShader.get(), nullptr, 0);
+	a_context->GSSetShader(geometryShader.get(), nullptr, 0);
+	a_context->DSSetShader(domainShader.get(), nullptr, 0);
+	a_context->HSSetShader(hullShader.get(), nullptr, 0);
+	a_context->VSSetShader(vertexShader.get(), nullptr, 0);
+	a_context->IASetInputLayout(inputLayout.get());
+	a_context->IASetPrimitiveTopology(topology);
+
+	alphaStencilView = nullptr;
+}
+
+ID3D11DepthStencilState* Upscaling::GetAlphaStencilState(ID3D11DepthStencilState* a_state, UINT& a_stencilRef)
+{
+	// The game's states live for the whole session, so variants are created once
+	auto it = alphaStencilStates.find(a_state);
+	if (it == alphaStencilStates.end()) {
+		D3D11_DEPTH_STENCIL_DESC desc{};
+		if (a_state) {
+			a_state->GetDesc(&desc);
+		} else {
+			desc.DepthEnable = TRUE;
+			desc.DepthWriteMask = D3D11_DEPTH_WRITE_MASK_ALL;
+			desc.DepthFunc = D3D11_COMPARISON_LESS;
+		}
+
+		winrt::com_ptr<ID3D11DepthStencilState> variant;
+
+		// States that already use the stencil keep it, one reference value cannot serve both
+		if (!desc.StencilEnable) {
+			desc.StencilEnable = TRUE;
+			desc.StencilReadMask = D3D11_DEFAULT_STENCIL_READ_MASK;
+			desc.StencilWriteMask = kAlphaStencilBit;
+			desc.FrontFace = { D3D11_STENCIL_OP_KEEP, D3D11_STENCIL_OP_KEEP, D3D11_STENCIL_OP_REPLACE, D3D11_COMPARISON_ALWAYS };
+			desc.BackFace = desc.FrontFace;
+
+			auto device = reinterpret_cast<ID3D11Device*>(RE::BSGraphics::RendererData::GetSingleton()->device);
+			DX::ThrowIfFailed(device->CreateDepthStencilState(&desc, variant.put()));
 		}
+
+		it = alphaStencilStates.emplace(a_state, variant).first;
 	}
 
-	QueryPerformanceCounter(&lastFrame);
+	if (!it->second) {
+		alphaStencilConflict = true;
+		return a_state;
+	}
+
+	a_stencilRef = kAlphaStencilBit;
+	return it->second.get();
 }
 
-void Upscaling::GameFrameLimiter()
+void Upscaling::TimerSleepQPC(int64_t targetQPC)
 {
-	double bestRefreshRate = 60.0f;
-
-	LARGE_INTEGER qpf;
-	QueryPerformanceFrequency(&qpf);
-
-	int64_t targetFrameTicks = int64_t(double(qpf.QuadPart) / bestRefreshRate);
-
-	static LARGE_INTEGER lastFrame = {};
-	LARGE_INTEGER timeNow;
-	QueryPerformanceCounter(&timeNow);
-	int64_t delta = timeNow.QuadPart - lastFrame.QuadPart;
-	if (delta < targetFrameTicks) {
-		TimerSleepQPC(lastFrame.QuadPart + targetFrameTicks);
-	}
-	QueryPerformanceCounter(&lastFrame);	
-}
-
-/*
-* Copyright (c) 2022-2023 NVIDIA CORPORATION. All rights reserved
-*
-* Permission is hereby granted, free of charge, to any person obtaining a copy
-* of this software and associated documentation files (the "Software"), to deal
-* in the Software without restriction, including without limitation the rights
-* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
-* copies of the Software, and to permit persons to whom the Software is
-* furnished to do so, subject to the following conditions:
-*
-* The above copyright notice and this permission notice shall be included in all
-* copies or substantial portions of the Software.
-*
-* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
-* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
-* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
-* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
-* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
-* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
-* SOFTWARE.
-*/
-
-double Upscaling::GetRefreshRate(HWND a_window)
-{
-	HMONITOR monitor = MonitorFromWindow(a_window, MONITOR_DEFAULTTONEAREST);
-	MONITORINFOEXW info;
-	info.cbSize = sizeof(info);
-	if (GetMonitorInfoW(monitor, &info) != 0) {
-		// using the CCD get the associated path and display configuration
-		UINT32 requiredPaths, requiredModes;
-		if (GetDisplayConfigBufferSizes(QDC_ONLY_ACTIVE_PATHS, &requiredPaths, &requiredModes) == ERROR_SUCCESS) {
-			std::vector<DISPLAYCONFIG_PATH_INFO> paths(requiredPaths);
-			std::vector<DISPLAYCONFIG_MODE_INFO> modes2(requiredModes);
-			if (QueryDisplayConfig(QDC_ONLY_ACTIVE_PATHS, &requiredPaths, paths.data(), &requiredModes, modes2.data(), nullptr) == ERROR_SUCCESS) {
-				// iterate through all the paths until find the exact source to match
-				for (auto& p : paths) {
-					DISPLAYCONFIG_SOURCE_DEVICE_NAME sourceName;
-					sourceName.header.type = DISPLAYCONFIG_DEVICE_INFO_GET_SOURCE_NAME;
-					sourceName.header.size = sizeof(sourceName);
-					sourceName.header.adapterId = p.sourceInfo.adapterId;
-					sourceName.header.id = p.sourceInfo.id;
-					if (DisplayConfigGetDeviceInfo(&sourceName.header) == ERROR_SUCCESS) {
-						// find the matched device which is associated with current device
-						// there may be the possibility that display may be duplicated and windows may be one of them in such scenario
-						// there may be two callback because source is same target will be different
-						// as window is on both the display so either selecting either one is ok
-						if (wcscmp(info.szDevice, sourceName.viewGdiDeviceName) == 0) {
-							// get the refresh rate
-							UINT numerator = p.targetInfo.refreshRate.Numerator;
-							UINT denominator = p.targetInfo.refreshRate.Denominator;
-							return (double)numerator / (double)denominator;
-						}
-					}
-				}
-			}
+	ZoneScopedNC("TimerSleepQPC", TRACY_WAIT_COLOR);
+
+	int64_t sleepTicks = sleeper.SleepUntil(targetQPC);
+	Telemetry::GetSingleton()->AddLimiterSleep(sleepTicks);
+	TracyPlot("Limiter sleep (ms)", double(sleepTicks) * 1000.0 / double(clock.Frequency()));
+
+	auto& stats = sleeper.stats;
+
+	if (stats.count >= 1000) {
+		double ticksToMs = 1000.0 / double(clock.Frequency());
+		logger::debug("[Frame Generation] Sleep overshoot avg {:.3f} ms, max {:.3f} ms, spin avg {:.3f} ms",
+			double(stats.totalOvershootTicks) / double(stats.count) * ticksToMs,
+			double(stats.maxOvershootTicks) * ticksToMs,
+			double(stats.totalSpinTicks) / double(stats.count) * ticksToMs);
+		stats.Reset();
+	}
+}
+
+void Upscaling::UpdateFrameStatistics()
+{
+	double currentRefreshRate = refreshRate;
+	vrrController.SetRefreshRate(currentRefreshRate);
+
+	DXGI_FRAME_STATISTICS frameStatistics{};
+	if (FAILED(DX12SwapChain::GetSingleton()->swapChain->GetFrameStatistics(&frameStatistics))) {
+		// Statistics are disjoint after mode changes, start over
+		lastFrameStatistics = {};
+		return;
+	}
+
+	if (lastFrameStatistics.PresentCount && frameStatistics.PresentCount > lastFrameStatistics.PresentCount) {
+		uint32_t presents = frameStatistics.PresentCount - lastFrameStatistics.PresentCount;
+		int64_t displayTicks = frameStatistics.SyncQPCTime.QuadPart - lastFrameStatistics.SyncQPCTime.QuadPart;
+		int64_t refreshTicks = int64_t(double(clock.Frequency()) / currentRefreshRate);
+
+		if (vrrController.Update(presents, displayTicks, refreshTicks))
+			logger::debug("[Frame Generation] VRR margin {:.2f}%, target {:.2f} Hz", vrrController.margin * 100.0, vrrController.GetTargetRate());
+	}
+
+	lastFrameStatistics = frameStatistics;
+}
+
+void Upscaling::FrameLimiter(bool a_useFrameGeneration)
+{
+	ZoneScoped;
+
+	int64_t targetFrameTicks = 0;
+
+	if (d3d12Interop && settings.frameLimitMode) {
+		double targetRate = FramePacer::GetVRRTargetRate(refreshRate);
+
+		if (settings.adaptiveFrameLimit) {
+			UpdateFrameStatistics();
+			targetRate = vrrController.GetTargetRate();
 		}
+
+		targetFrameTicks = FramePacer::GetTargetInterval(clock.Frequency(), targetRate, a_useFrameGeneration);
 	}
-	logger::error("Failed to retrieve refresh rate from swap chain");
-	return 60;
+
+	framePacer.Limit(clock, targetFrameTicks, [this](int64_t a_targetQPC) { TimerSleepQPC(a_targetQPC); });
+}
+
+void Upscaling::GameFrameLimiter()
+{
+	ZoneScoped;
+
+	int64_t targetFrameTicks = FramePacer::GetTargetInterval(clock.Frequency(), 60.0, false);
+
+	gameFramePacer.Limit(clock, targetFrameTicks, [this](int64_t a_targetQPC) { TimerSleepQPC(a_targetQPC); });
 }
 
 void Upscaling::PostDisplay()
 {
+	ZoneScoped;
+
 	if (!d3d12Interop)
 		return;
 
+	Telemetry::GetSingleton()->Mark(Telemetry::Event::kPostDisplay);
+
 	if (!setupBuffers)
 		CreateFrameGenerationResources();
 	
@@ -508,32 +1335,239 @@ void Upscaling::PostDisplay()
 	
 	auto dx12SwapChain = DX12SwapChain::GetSingleton();
 
+	auto gpuProfiler = GPUProfiler::GetSingleton();
+	gpuProfiler->Begin(GPUProfiler::Pass::kCopyHUDLess);
 	reinterpret_cast<ID3D11DeviceContext*>(rendererData->context)->CopyResource(HUDLessBufferShared[dx12SwapChain->frameIndex]->resource.get(), swapChainResource);
+	gpuProfiler->End(GPUProfiler::Pass::kCopyHUDLess);
+
+	HUDLessWritten = true;
+}
+
+void Upscaling::SetFrameBuffer(ID3D11Texture2D* a_texture, ID3D11RenderTargetView* a_rtv, ID3D11ShaderResourceView* a_srv)
+{
+	auto rendererData = RE::BSGraphics::RendererData::GetSingleton();
+	SetRenderTarget(rendererData->renderTargets[(uint)RenderTarget::kFrameBuffer], a_texture, a_rtv, a_srv);
+}
+
+void Upscaling::SetMotionVectorBuffer(uint32_t a_slot)
+{
+	if (!motionVectorsZeroCopy)
+		return;
+
+	auto rendererData = RE::BSGraphics::RendererData::GetSingleton();
+	auto& motionVector = rendererData->renderTargets[(uint)RenderTarget::kMotionVectors];
+
+	// The game recreated its target, which must not be swapped out from under it
+	if (motionVector.texture != reinterpret_cast<decltype(motionVector.texture)>(gameMotionVectorTexture) && !IsSharedMotionVectorTexture(motionVector.texture)) {
+		logger::warn("[Frame Generation] Motion vector target was recreated, copying instead");
+		ReleaseGameMotionVectors();
+		return;
+	}
+
+	auto& shared = motionVectorBufferShared[a_slot];
+	SetRenderTarget(motionVector, shared->resource.get(), shared->rtv.get(), shared->srv.get());
+}
+
+bool Upscaling::IsSharedMotionVectorTexture(const void* a_texture)
+{
+	for (uint32_t index = 0; index < FrameRing::kMaxDepth; index++) {
+		if (motionVectorBufferShared[index] && motionVectorBufferShared[index]->resource.get() == a_texture)
+			return true;
+	}
+	return false;
+}
+
+void Upscaling::ReleaseGameMotionVectors()
+{
+	motionVectorsZeroCopy = false;
+
+	if (!gameMotionVectorTexture)
+		return;
+
+	// Only put back if one of the shared textures is still in its place
+	auto& motionVector = RE::BSGraphics::RendererData::GetSingleton()->renderTargets[(uint)RenderTarget::kMotionVectors];
+	if (IsSharedMotionVectorTexture(motionVector.texture))
+		SetRenderTarget(motionVector, gameMotionVectorTexture, gameMotionVectorRTV, gameMotionVectorSRV);
+
+	gameMotionVectorTexture->Release();
+	gameMotionVectorRTV->Release();
+	gameMotionVectorSRV->Release();
+
+	gameMotionVectorTexture = nullptr;
+	gameMotionVectorRTV = nullptr;
+	gameMotionVectorSRV = nullptr;
+}
+
+bool Upscaling::SharedInputSizeChanged()
+{
+	if (!HUDLessBufferShared[0])
+		return true;
+
+	auto& main = RE::BSGraphics::RendererData::GetSingleton()->renderTargets[(uint)RenderTarget::kMain];
+
+	D3D11_TEXTURE2D_DESC mainDesc{};
+	reinterpret_cast<ID3D11Texture2D*>(main.texture)->GetDesc(&mainDesc);
+
+	return HUDLessBufferShared[0]->desc.Width != mainDesc.Width || HUDLessBufferShared[0]->desc.Height != mainDesc.Height;
+}
+
+bool Upscaling::MotionVectorsShared()
+{
+	if (!motionVectorsZeroCopy)
+		return false;
+
+	auto rendererData = RE::BSGraphics::RendererData::GetSingleton();
+	auto frameIndex = DX12SwapChain::GetSingleton()->frameIndex;
+	return rendererData->renderTargets[(uint)RenderTarget::kMotionVectors].texture == reinterpret_cast<decltype(RE::BSGraphics::RenderTarget::texture)>(motionVectorBufferShared[frameIndex]->resource.get());
 }
 
 void Upscaling::Reset()
 {
+	ZoneScoped;
+
 	if (!d3d12Interop)
 		return;
 
-	if (!setupBuffers)
+	// The game can recreate its targets at another size without resizing the swap chain, checked once a frame
+	if (!setupBuffers || SharedInputSizeChanged())
 		CreateFrameGenerationResources();
 
-	auto rendererData = RE::BSGraphics::RendererData::GetSingleton();
-	auto context = reinterpret_cast<ID3D11DeviceContext*>(rendererData->context);
+	auto dx12SwapChain = DX12SwapChain::GetSingleton();
+	auto context = dx12SwapChain->d3d11Context.get();
+	auto frameIndex = dx12SwapChain->frameIndex;
+
+	// The passes overwrite everything FSR reads, so the old contents are only discarded
+	context->DiscardResource(HUDLessBufferShared[frameIndex]->resource.get());
+
+	if (depthMotionVectorsPacked) {
+		context->DiscardResource(depthMotionVectorShared[frameIndex]->resource.get());
+	} else {
+		context->DiscardResource(depthBufferShared[frameIndex]->resource.get());
+
+		// The game renders into it and may rely on it starting out cleared
+		if (MotionVectorsShared()) {
+			FLOAT clearColor[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+			context->ClearRenderTargetView(motionVectorBufferShared[frameIndex]->rtv.get(), clearColor);
+		} else {
+			context->DiscardResource(motionVectorBufferShared[frameIndex]->resource.get());
+		}
+	}
+
+	inputsWritten = false;
+	HUDLessWritten = false;
+	renderSizeMeasured = false;
+}
+
+void Upscaling::ClearSkippedInputs(bool a_useFrameGeneration)
+{
+	// FSR only reads the inputs on frames it generates from
+	if (!d3d12Interop || !setupBuffers || !a_useFrameGeneration || (inputsWritten && HUDLessWritten))
+		return;
 
 	auto dx12SwapChain = DX12SwapChain::GetSingleton();
+	auto context = dx12SwapChain->d3d11Context.get();
+	auto frameIndex = dx12SwapChain->frameIndex;
+
+	auto gpuProfiler = GPUProfiler::GetSingleton();
+	gpuProfiler->Begin(GPUProfiler::Pass::kReset);
 
 	FLOAT clearColor[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
-	context->ClearRenderTargetView(HUDLessBufferShared[dx12SwapChain->frameIndex]->rtv.get(), clearColor);
-	context->ClearRenderTargetView(depthBufferShared[dx12SwapChain->frameIndex]->rtv.get(), clearColor);
-	context->ClearRenderTargetView(motionVectorBufferShared[dx12SwapChain->frameIndex]->rtv.get(), clearColor);
+
+	if (!HUDLessWritten)
+		context->ClearUnorderedAccessViewFloat(HUDLessBufferShared[frameIndex]->uav.get(), clearColor);
+
+	if (!inputsWritten) {
+		if (depthMotionVectorsPacked) {
+			UINT clearValue[4] = { 0, 0, 0, 0 };
+			context->ClearUnorderedAccessViewUint(depthMotionVectorShared[frameIndex]->uav.get(), clearValue);
+		} else {
+			context->ClearUnorderedAccessViewFloat(depthBufferShared[frameIndex]->uav.get(), clearColor);
+			context->ClearUnorderedAccessViewFloat(motionVectorBufferShared[frameIndex]->uav.get(), clearColor);
+		}
+	}
+
+	gpuProfiler->End(GPUProfiler::Pass::kReset);
+}
+
+void Upscaling::CaptureInputs(uint64_t a_frame)
+{
+	if (!settings.captureInterval || captureCount >= kMaxCaptures || !setupBuffers || !captureDepthMotionVectorsCS || a_frame % settings.captureInterval)
+		return;
+
+	auto rendererData = RE::BSGraphics::RendererData::GetSingleton();
+	auto device = reinterpret_cast<ID3D11Device*>(rendererData->device);
+	auto context = reinterpret_cast<ID3D11DeviceContext*>(rendererData->context);
+
+	// The game's targets still hold the frame that was just presented
+	{
+		auto& motionVector = rendererData->renderTargets[(uint)RenderTarget::kMotionVectors];
+		auto& depth = rendererData->depthStencilTargets[(uint)DepthStencilTarget::kMain];
+
+		auto renderSize = GetRenderSize();
+		uint32_t dispatchX = (uint32_t)std::ceil(float(renderSize.width) / 8.0f);
+		uint32_t dispatchY = (uint32_t)std::ceil(float(renderSize.height) / 8.0f);
+
+		ID3D11ShaderResourceView* views[2] = {
+			reinterpret_cast<ID3D11ShaderResourceView*>(depth.srViewDepth),
+			reinterpret_cast<ID3D11ShaderResourceView*>(motionVector.srView)
+		};
+		context->CSSetShaderResources(0, ARRAYSIZE(views), views);
+
+		context->CSSetShader(captureDepthMotionVectorsCS, nullptr, 0);
+
+		for (uint32_t precision = 0; precision < 2; precision++) {
+			ID3D11UnorderedAccessView* uavs[2] = { captureMotionVectors[precision]->uav.get(), captureDepth[precision]->uav.get() };
+			context->CSSetUnorderedAccessViews(0, ARRAYSIZE(uavs), uavs, nullptr);
+			context->Dispatch(dispatchX, dispatchY, 1);
+		}
+
+		ID3D11ShaderResourceView* nullViews[2] = { nullptr, nullptr };
+		context->CSSetShaderResources(0, ARRAYSIZE(nullViews), nullViews);
+
+		ID3D11UnorderedAccessView* nullUavs[2] = { nullptr, nullptr };
+		context->CSSetUnorderedAccessViews(0, ARRAYSIZE(nullUavs), nullUavs, nullptr);
+
+		ID3D11ComputeShader* shader = nullptr;
+		context->CSSetShader(shader, nullptr, 0);
+	}
+
+	std::filesystem::path directory = "Data\\F4SE\\Plugins\\FrameGeneration\\Captures";
+	std::filesystem::create_directories(directory);
+
+	auto capture = [&](Texture2D* a_texture, const char* a_name) {
+		if (!a_texture)
+			return;
+
+		// Stalls on the readback, which is fine for a debugging aid
+		DirectX::ScratchImage image;
+		if (FAILED(DirectX::CaptureTexture(device, context, a_texture->resource.get(), image))) {
+			logger::warn("[Frame Generation] Failed to capture {}", a_name);
+			return;
+		}
+
+		auto path = directory / std::format("{:06}_{}.dds", a_frame, a_name);
+		if (FAILED(DirectX::SaveToDDSFile(image.GetImages(), image.GetImageCount(), image.GetMetadata(), DirectX::DDS_FLAGS_FORCE_DX10_EXT, path.c_str())))
+			logger::warn("[Frame Generation] Failed to write {}", path.string());
+	};
+
+	capture(captureDepth[0], "depth_full");
+	capture(captureMotionVectors[0], "motionvectors_full");
+	capture(captureDepth[1], "depth");
+	capture(captureMotionVectors[1], "motionvectors");
+
+	captureCount++;
+	logger::info("[Frame Generation] Captured frame generation inputs of frame {} ({} of {})", a_frame, captureCount, kMaxCaptures);
 }
 
 struct WindowSizeChanged
 {
-	static void thunk(RE::BSGraphics::Renderer*, unsigned int)
+	// The engine also calls this while initialising, at the size the swap chain was created with. Only real changes reach
+	// the engine, which recreates its render targets and resizes through the swap chain proxy
+	static void thunk(RE::BSGraphics::Renderer* This, unsigned int a_index)
 	{
+		ZoneScopedN("WindowSizeChanged");
+		if (DX12SwapChain::GetSingleton()->WindowSizeChanged())
+			func(This, a_index);
 	}
 	static inline REL::Relocation<decltype(thunk)> func;
 };
@@ -542,6 +1576,7 @@ struct SetUseDynamicResolutionViewportAsDefaultViewport
 {
 	static void thunk(RE::BSGraphics::RenderTargetManager* This, bool a_true)
 	{
+		ZoneScopedN("SetUseDynamicResolutionViewportAsDefaultViewport");
 		func(This, a_true);
 		if (!a_true)
 			Upscaling::GetSingleton()->PostDisplay();
@@ -554,7 +1589,8 @@ bool reticleFix = false;
 struct DrawWorld_Forward
 {
 	static void thunk(void* a1)
-	{		
+	{
+		ZoneScopedN("DrawWorld_Forward");
 		func(a1);
 
 		if (!reticleFix)
@@ -569,6 +1605,9 @@ struct DrawWorld_Reticle
 {
 	static void thunk(void* a1)
 	{
+		ZoneScopedN("DrawWorld_Reticle");
+		Telemetry::GetSingleton()->Mark(Telemetry::Event::kDrawWorldReticle);
+
 		auto upscaling = Upscaling::GetSingleton();
 		upscaling->PreAlpha();
 		func(a1);
@@ -1,6 +1,13 @@
 #pragma once
 
+#include <atomic>
+#include <unordered_map>
+
 #include "Buffer.h"
+#include "FramePacing.h"
+#include "FrameRing.h"
+#include "PreciseSleep.h"
+#include "QPCClock.h"
 
 #include "SimpleIni.h"
 
@@ -13,10 +20,50 @@ public:
 		return &singleton;
 	}
 
+	// How alpha geometry drawn after the opaque pass is kept out of the motion vectors and depth
+	enum class AlphaMaskMode : uint32_t
+	{
+		kColorDifference,
+		kTiles,
+		kStencil
+	};
+
+	// Storage of the shared depth, reduced precision halves its bandwidth and memory
+	enum class DepthPrecision : uint32_t
+	{
+		kFloat32,
+		kFloat16,
+		kUnorm16
+	};
+
+	// Shared inputs are written to DDS files at most this many times per session
+	static constexpr uint32_t kMaxCaptures = 16;
+
+	// Set by alpha draws in kStencil mode and cleared again once read, so later passes see the game's stencil
+	static constexpr UINT kAlphaStencilBit = 0x80;
+
+	// Frames the colour difference mask stays on after an alpha draw whose own state uses the stencil
+	static constexpr uint32_t kAlphaStencilFallbackFrames = 300;
+
 	struct Settings
 	{
 		bool frameGenerationMode = 1;
 		bool frameLimitMode = 1;
+		bool adaptiveFrameLimit = 0;
+		bool lowLatencyMode = 0;
+		bool telemetry = 0;
+		bool gpuProfiling = 0;
+		bool zeroCopyMotionVectors = 0;
+		bool packDepthMotionVectors = 0;
+		AlphaMaskMode alphaMaskMode = AlphaMaskMode::kColorDifference;
+		DepthPrecision depthPrecision = DepthPrecision::kFloat32;
+		bool halfMotionVectors = 0;
+		uint32_t captureInterval = 0;
+		uint32_t frameRingDepth = 2;
+		uint32_t maxFramesAhead = 1;
+		uint32_t maxFrameLatency = 1;
+		uint32_t transferQueue = 0;
+		float sleepSpinMargin = 0.75f;
 	};
 
 	Settings settings;
@@ -24,41 +71,163 @@ public:
 	bool highFPSPhysicsFixLoaded = false;
 
 	bool d3d12Interop = false;
-	double refreshRate = 0.0f;
+	// Written by DisplayWatcher whenever the game window changes monitor or the mode changes
+	std::atomic<double> refreshRate = 0.0;
 
-	Texture2D* HUDLessBufferShared[2];
-	Texture2D* depthBufferShared[2];
-	Texture2D* motionVectorBufferShared[2];
+	Texture2D* HUDLessBufferShared[FrameRing::kMaxDepth]{};
+	Texture2D* depthBufferShared[FrameRing::kMaxDepth]{};
+	Texture2D* motionVectorBufferShared[FrameRing::kMaxDepth]{};
 	
-	winrt::com_ptr<ID3D12Resource> HUDLessBufferShared12[2];
-	winrt::com_ptr<ID3D12Resource> depthBufferShared12[2];
-	winrt::com_ptr<ID3D12Resource> motionVectorBufferShared12[2];
-
-	ID3D11ComputeShader* copyDepthToSharedBufferCS;
-	ID3D11ComputeShader* generateSharedBuffersCS;
+	winrt::com_ptr<ID3D12Resource> HUDLessBufferShared12[FrameRing::kMaxDepth];
+	winrt::com_ptr<ID3D12Resource> depthBufferShared12[FrameRing::kMaxDepth];
+	winrt::com_ptr<ID3D12Resource> motionVectorBufferShared12[FrameRing::kMaxDepth];
+
+	// Packed depth and motion vectors, one shared texture and one UAV instead of two, split again on the D3D12 side
+	bool depthMotionVectorsPacked = false;
+
+	// The shared motion vectors have a different format from the game's, so they are converted by a dispatch instead of copied
+	bool motionVectorsConverted = false;
+	Texture2D* depthMotionVectorShared[FrameRing::kMaxDepth]{};
+	winrt::com_ptr<ID3D12Resource> depthMotionVectorShared12[FrameRing::kMaxDepth];
+
+	ID3D11ComputeShader* copyDepthToSharedBufferCS = nullptr;
+	ID3D11ComputeShader* copyDepthMotionVectorsCS = nullptr;
+	ID3D11ComputeShader* generateSharedBuffersCS = nullptr;
+
+	// Tile alpha mask, a 16-bit hash per pixel and a signature per 8x8 tile of the pre-alpha colour instead of a full copy, and a list of the tiles alpha touched
+	Texture2D* colorHashPreAlpha = nullptr;
+	Texture2D* tileSignaturePreAlpha = nullptr;
+	Buffer* alphaTileList = nullptr;
+	Buffer* alphaTileArgs = nullptr;
+
+	ID3D11ComputeShader* snapshotColorCS = nullptr;
+	ID3D11ComputeShader* classifyAlphaTilesCS = nullptr;
+	ID3D11ComputeShader* maskAlphaTilesCS = nullptr;
+
+	// Stencil alpha mask, the game's depth stencil states get a variant that also writes kAlphaStencilBit while alpha draws
+	bool alphaStencilActive = false;
+	ID3D11DepthStencilState* gameDepthStencilState = nullptr;
+	UINT gameStencilRef = 0;
+	std::unordered_map<ID3D11DepthStencilState*, winrt::com_ptr<ID3D11DepthStencilState>> alphaStencilStates;
+	winrt::com_ptr<ID3D11DepthStencilView> alphaStencilView;
+
+	// Draws that keep their own stencil are not marked, so the frames after one also copy the colour before alpha and use the difference mask
+	bool alphaStencilConflict = false;
+	bool alphaStencilColorCopy = false;
+	uint32_t alphaStencilFallbackFrames = 0;
+
+	winrt::com_ptr<ID3D11ShaderResourceView> stencilSRV;
+	ID3D11ComputeShader* generateSharedBuffersStencilCS = nullptr;
+
+	// Resets kAlphaStencilBit with a draw over the render region that writes only that bit
+	ID3D11VertexShader* clearStencilBitVS = nullptr;
+	winrt::com_ptr<ID3D11DepthStencilState> clearStencilBitState;
+	winrt::com_ptr<ID3D11RasterizerState> clearStencilBitRasterizerState;
+
+	// Zero-copy motion vectors, the game renders into the slot's shared texture and its own target is kept for restoring
+	bool motionVectorsZeroCopy = false;
+	ID3D11Texture2D* gameMotionVectorTexture = nullptr;
+	ID3D11RenderTargetView* gameMotionVectorRTV = nullptr;
+	ID3D11ShaderResourceView* gameMotionVectorSRV = nullptr;
+
+	// Mask variants that leave the shared motion vectors as the game rendered them
+	ID3D11ComputeShader* generateSharedBuffersDepthOnlyCS = nullptr;
+	ID3D11ComputeShader* generateSharedBuffersStencilDepthOnlyCS = nullptr;
+	ID3D11ComputeShader* maskAlphaTilesDepthOnlyCS = nullptr;
+
+	// The game's depth and motion vectors of a capture frame, written once at full and once at the shared precision
+	uint32_t captureCount = 0;
+	Texture2D* captureDepth[2]{};
+	Texture2D* captureMotionVectors[2]{};
+	ID3D11ComputeShader* captureDepthMotionVectorsCS = nullptr;
 
 	bool setupBuffers = false;
 
+	// Set by the passes that write the current slot, whatever a skipped pass left discarded is cleared at Present
+	bool inputsWritten = false;
+	bool HUDLessWritten = false;
+
+	// Region the game rendered this frame, the top left of its targets, smaller than the frame under dynamic resolution
+	struct RenderSize
+	{
+		uint32_t width;
+		uint32_t height;
+
+		// Exact dynamic resolution scale, the size is rounded up from it
+		float widthRatio;
+		float heightRatio;
+	};
+
+	// Kept with the slot so the D3D11 passes and the FSR dispatch of a frame see the same size
+	RenderSize renderSizes[FrameRing::kMaxDepth]{};
+	bool renderSizeMeasured = false;
+
 	void LoadSettings();
 
 	void PostPostLoad();
 
 	void CreateFrameGenerationResources();
+	void ReleaseFrameGenerationResources();
 	void PreAlpha();
 	void PostAlpha();
 	void CopyBuffersToSharedResources();
+	void CopyMotionVectorsAndDepth();
+	void MaskAlphaTiles();
+
+	// Fills the UAVs the alpha mask shaders write for the current slot, returns how many there are
+	UINT GetSharedOutputUAVs(ID3D11UnorderedAccessView** a_uavs);
+
+	// Region the game rendered into the current slot, measured on first use in the frame
+	RenderSize GetRenderSize();
+
+	// Copies only the rendered region, FSR never reads the rest of the shared textures
+	void CopyRenderRegion(ID3D11DeviceContext* a_context, ID3D11Resource* a_destination, ID3D11Resource* a_source);
+
+	// Writes the current slot's shared depth and motion vectors to DDS every iCaptureInterval frames, for offline error measurements
+	void CaptureInputs(uint64_t a_frame);
+
+	bool BeginAlphaStencil(ID3D11DeviceContext* a_context);
+	void EndAlphaStencil(ID3D11DeviceContext* a_context);
+	void ClearAlphaStencil(ID3D11DeviceContext* a_context);
+	ID3D11DepthStencilState* GetAlphaStencilState(ID3D11DepthStencilState* a_state, UINT& a_stencilRef);
+
+	QPCClock clock;
+	PreciseSleeper<QPCClock> sleeper{ clock };
+
+	FramePacer framePacer;
+	FramePacer gameFramePacer;
 
-	static void TimerSleepQPC(int64_t targetQPC);
+	VRRMarginController vrrController;
+	DXGI_FRAME_STATISTICS lastFrameStatistics{};
+
+	void TimerSleepQPC(int64_t targetQPC);
+
+	void UpdateFrameStatistics();
 
 	void FrameLimiter(bool a_useFrameGeneration);
 
 	void GameFrameLimiter();
 
-	static double GetRefreshRate(HWND a_window);
-
 	void PostDisplay();
 
+	void SetFrameBuffer(ID3D11Texture2D* a_texture, ID3D11RenderTargetView* a_rtv, ID3D11ShaderResourceView* a_srv);
+
+	// Points the game's motion vector target at the slot's shared texture, called at the frame boundary
+	void SetMotionVectorBuffer(uint32_t a_slot);
+	bool MotionVectorsShared();
+	bool IsSharedMotionVectorTexture(const void* a_texture);
+
+	// True when the game's kMain no longer has the size the shared inputs were created at
+	bool SharedInputSizeChanged();
+
+	// Puts the game's own motion vector target back and stops substituting
+	void ReleaseGameMotionVectors();
+
+	// Discards the next slot's inputs after Present
 	void Reset();
 
+	// Clears the inputs no pass wrote this frame, before D3D12 reads them
+	void ClearSkippedInputs(bool a_useFrameGeneration);
+
 	static void InstallHooks();
 };
@@ -0,0 +1,557 @@
+// Headless frame pacing simulator
+//
+// Feeds recorded or synthetic frame-time traces through the plugin's pacing code
+// (FramePacer and PreciseSleeper) on a virtual clock and reports how frames reach
+// a simulated display.
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "FramePacing.h"
+#include "FrameTimePredictor.h"
+#include "PreciseSleep.h"
+
+static constexpr int64_t kFrequency = 10'000'000;
+
+// Exit code of a run that completed but exceeded a --max/--min limit, errors exit with 1
+static constexpr int kExitLimitExceeded = 3;
+
+// Fraction of the predicted frame time --predictive holds real frames to, below 1 so the prediction can fall
+static constexpr double kPredictionSlack = 0.95;
+
+// Telemetry::Event::kPresent, the plugin's trace files are replayed from the interval between presents
+static constexpr uint32_t kTracePresentEvent = 7;
+static constexpr uint32_t kTraceMagic = 0x52544746;
+
+static int64_t MsToTicks(double a_ms)
+{
+	return int64_t(std::llround(a_ms * double(kFrequency) / 1000.0));
+}
+
+static double TicksToMs(int64_t a_ticks)
+{
+	return double(a_ticks) * 1000.0 / double(kFrequency);
+}
+
+// Deterministic across platforms, unlike the standard distributions
+class Random
+{
+public:
+	explicit Random(uint64_t a_seed) :
+		state(a_seed) {}
+
+	double Next()
+	{
+		uint64_t z = (state += 0x9E3779B97F4A7C15ull);
+		z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+		z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+		z = z ^ (z >> 31);
+		return double(z >> 11) * (1.0 / 9007199254740992.0);
+	}
+
+private:
+	uint64_t state;
+};
+
+class VirtualClock
+{
+public:
+	VirtualClock(Random& a_random, int64_t a_wakeLatency) :
+		random(a_random), wakeLatency(a_wakeLatency) {}
+
+	int64_t Now() { return now; }
+	int64_t Frequency() const { return kFrequency; }
+
+	// OS timers wake up late by a random amount
+	void Block(int64_t a_ticks) { now += a_ticks + int64_t(random.Next() * double(wakeLatency)); }
+	void Pause() { now += 5; }
+
+	void Advance(int64_t a_ticks) { now += a_ticks; }
+	void AdvanceTo(int64_t a_ticks) { now = std::max(now, a_ticks); }
+
+private:
+	Random& random;
+	int64_t wakeLatency;
+	int64_t now = 0;
+};
+
+struct Options
+{
+	std::string tracePath;
+	size_t frames = 0;
+	double frameTime = 8.0;
+	double jitter = 0.0;
+	size_t spikeEvery = 0;
+	double spike = 0.0;
+	double refreshRate = 144.0;
+	double wakeLatency = 0.3;
+	double spinMargin = 0.75;
+	size_t maxQueued = 2;
+	size_t warmup = 120;
+	uint64_t seed = 1;
+	bool vsync = false;
+	bool frameGeneration = false;
+	bool frameLimit = true;
+	bool adaptive = false;
+	bool predictive = false;
+	bool gameLimiter = true;
+
+	// Regression limits, a run that exceeds one fails
+	double maxMidpointP99 = 0.0;
+	double maxJudderP99 = 0.0;
+	double minOutputRate = 0.0;
+};
+
+// Scans out presented frames, VRR up to the refresh rate or fixed refresh with vsync
+class Display
+{
+public:
+	Display(int64_t a_refreshInterval, bool a_fixedRefresh, size_t a_maxQueued) :
+		refreshInterval(a_refreshInterval), fixedRefresh(a_fixedRefresh), maxQueued(a_maxQueued) {}
+
+	int64_t Schedule(int64_t a_presentTime)
+	{
+		int64_t scan = std::max(a_presentTime, lastScan + refreshInterval);
+		if (fixedRefresh)
+			scan = ((scan + refreshInterval - 1) / refreshInterval) * refreshInterval;
+
+		if (lastScan > INT64_MIN / 2)
+			intervals.push_back(scan - lastScan);
+
+		lastScan = scan;
+		queue.push_back(scan);
+		return scan;
+	}
+
+	// Present blocks while too many frames are waiting for scanout
+	void Backpressure(VirtualClock& a_clock, size_t a_framesPerPresent)
+	{
+		while (!queue.empty() && queue.front() <= a_clock.Now())
+			queue.pop_front();
+
+		while (queue.size() > maxQueued * a_framesPerPresent) {
+			a_clock.AdvanceTo(queue.front());
+			queue.pop_front();
+		}
+	}
+
+	std::vector<int64_t> intervals;
+
+private:
+	int64_t refreshInterval;
+	bool fixedRefresh;
+	size_t maxQueued;
+	int64_t lastScan = INT64_MIN;
+	std::deque<int64_t> queue;
+};
+
+// Telemetry trace written by the plugin with bTelemetry, see Telemetry::TraceHeader
+static std::vector<double> LoadTelemetryTrace(std::ifstream& a_file)
+{
+	struct Header
+	{
+		uint32_t magic;
+		uint32_t version;
+		int64_t frequency;
+		uint32_t eventCount;
+		uint32_t recordSize;
+		uint32_t gpuPassCount;
+		uint32_t padding;
+	} header{};
+
+	std::vector<double> trace;
+
+	a_file.read(reinterpret_cast<char*>(&header), sizeof(header));
+	if (!a_file || header.frequency <= 0 || header.eventCount <= kTracePresentEvent || header.recordSize < 8 + header.eventCount * 8)
+		return trace;
+
+	std::vector<char> record(header.recordSize);
+	int64_t lastPresent = 0;
+
+	while (a_file.read(record.data(), header.recordSize)) {
+		// frameID, then one timestamp per event
+		int64_t present;
+		std::memcpy(&present, record.data() + 8 + kTracePresentEvent * 8, sizeof(present));
+		if (!present)
+			continue;
+
+		if (lastPresent && present > lastPresent)
+			trace.push_back(double(present - lastPresent) * 1000.0 / double(header.frequency));
+		lastPresent = present;
+	}
+
+	return trace;
+}
+
+static std::vector<double> LoadTrace(const std::string& a_path)
+{
+	std::vector<double> trace;
+
+	std::ifstream file(a_path, std::ios::binary);
+	if (!file) {
+		std::fprintf(stderr, "Failed to open trace %s\n", a_path.c_str());
+		std::exit(1);
+	}
+
+	uint32_t magic = 0;
+	file.read(reinterpret_cast<char*>(&magic), sizeof(magic));
+	file.seekg(0);
+	if (magic == kTraceMagic)
+		return LoadTelemetryTrace(file);
+
+	// First numeric field of each line is the frame time in milliseconds
+	std::string line;
+	while (std::getline(file, line)) {
+		if (line.empty() || line[0] == '#')
+			continue;
+
+		std::replace(line.begin(), line.end(), ',', ' ');
+		std::istringstream stream(line);
+		double value;
+		if (stream >> value && value > 0.0)
+			trace.push_back(value);
+	}
+
+	return trace;
+}
+
+static std::vector<double> BuildTrace(const Options& a_options, Random& a_random)
+{
+	std::vector<double> trace;
+
+	if (!a_options.tracePath.empty()) {
+		auto recorded = LoadTrace(a_options.tracePath);
+		if (recorded.empty()) {
+			std::fprintf(stderr, "Trace %s has no frames\n", a_options.tracePath.c_str());
+			std::exit(1);
+		}
+
+		size_t frames = a_options.frames ? a_options.frames : recorded.size();
+		for (size_t i = 0; i < frames; i++)
+			trace.push_back(recorded[i % recorded.size()]);
+		return trace;
+	}
+
+	size_t frames = a_options.frames ? a_options.frames : 10000;
+	for (size_t i = 0; i < frames; i++) {
+		double frameTime = a_options.frameTime + (a_random.Next() * 2.0 - 1.0) * a_options.jitter;
+		if (a_options.spikeEvery && (i + 1) % a_options.spikeEvery == 0)
+			frameTime += a_options.spike;
+		trace.push_back(std::max(0.1, frameTime));
+	}
+
+	return trace;
+}
+
+static double Percentile(std::vector<double> a_values, double a_percentile)
+{
+	if (a_values.empty())
+		return 0.0;
+
+	std::sort(a_values.begin(), a_values.end());
+	double rank = a_percentile / 100.0 * double(a_values.size() - 1);
+	size_t lower = size_t(rank);
+	size_t upper = std::min(lower + 1, a_values.size() - 1);
+	double fraction = rank - double(lower);
+	return a_values[lower] + (a_values[upper] - a_values[lower]) * fraction;
+}
+
+static double Mean(const std::vector<double>& a_values)
+{
+	if (a_values.empty())
+		return 0.0;
+
+	double sum = 0.0;
+	for (double value : a_values)
+		sum += value;
+	return sum / double(a_values.size());
+}
+
+static void PrintUsage()
+{
+	std::printf(
+		"Usage: FramePacingSimulator [options]\n"
+		"  --trace <file>        frame times in ms, one per line (first column of CSV), or a bTelemetry trace\n"
+		"  --frames <n>          frames to simulate (loops the trace)\n"
+		"  --frametime <ms>      synthetic frame time (default 8.0)\n"
+		"  --jitter <ms>         synthetic uniform jitter\n"
+		"  --spike-every <n>     add a spike every n frames\n"
+		"  --spike <ms>          spike size\n"
+		"  --refresh <hz>        display refresh rate (default 144)\n"
+		"  --vsync               fixed refresh presentation, frame limiter disabled\n"
+		"  --framegen            frame generation enabled\n"
+		"  --no-frame-limit      bFrameLimitMode=false\n"
+		"  --adaptive            bAdaptiveFrameLimit=true\n"
+		"  --predictive          pace with FrameTimePredictor, a candidate the plugin does not use\n"
+		"  --physics-fix         HighFPSPhysicsFix loaded, no 60 Hz game limiter\n"
+		"  --spin-margin <ms>    fSleepSpinMargin (default 0.75)\n"
+		"  --wake-latency <ms>   maximum OS timer wake-up delay (default 0.3)\n"
+		"  --max-queued <n>      presents queued before Present blocks (default 2)\n"
+		"  --warmup <n>          frames excluded from the report (default 120)\n"
+		"  --seed <n>            random seed (default 1)\n"
+		"  --max-midpoint-p99 <ms>  fail if the generated frame midpoint error p99 is higher\n"
+		"  --max-judder-p99 <ms>    fail if the judder p99 is higher\n"
+		"  --min-output-rate <fps>  fail if the output rate is lower\n"
+		"Exits with 3 when a limit is exceeded and 1 on errors\n");
+}
+
+static Options ParseOptions(int argc, char** argv)
+{
+	Options options;
+
+	for (int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		auto value = [&]() -> const char* {
+			if (i + 1 >= argc) {
+				std::fprintf(stderr, "Missing value for %s\n", arg.c_str());
+				std::exit(1);
+			}
+			return argv[++i];
+		};
+
+		if (arg == "--trace")
+			options.tracePath = value();
+		else if (arg == "--frames")
+			options.frames = std::strtoull(value(), nullptr, 10);
+		else if (arg == "--frametime")
+			options.frameTime = std::atof(value());
+		else if (arg == "--jitter")
+			options.jitter = std::atof(value());
+		else if (arg == "--spike-every")
+			options.spikeEvery = std::strtoull(value(), nullptr, 10);
+		else if (arg == "--spike")
+			options.spike = std::atof(value());
+		else if (arg == "--refresh")
+			options.refreshRate = std::atof(value());
+		else if (arg == "--vsync")
+			options.vsync = true;
+		else if (arg == "--framegen")
+			options.frameGeneration = true;
+		else if (arg == "--no-frame-limit")
+			options.frameLimit = false;
+		else if (arg == "--adaptive")
+			options.adaptive = true;
+		else if (arg == "--predictive")
+			options.predictive = true;
+		else if (arg == "--physics-fix")
+			options.gameLimiter = false;
+		else if (arg == "--spin-margin")
+			options.spinMargin = std::atof(value());
+		else if (arg == "--wake-latency")
+			options.wakeLatency = std::atof(value());
+		else if (arg == "--max-queued")
+			options.maxQueued = std::max<size_t>(1, std::strtoull(value(), nullptr, 10));
+		else if (arg == "--warmup")
+			options.warmup = std::strtoull(value(), nullptr, 10);
+		else if (arg == "--seed")
+			options.seed = std::strtoull(value(), nullptr, 10);
+		else if (arg == "--max-midpoint-p99")
+			options.maxMidpointP99 = std::atof(value());
+		else if (arg == "--max-judder-p99")
+			options.maxJudderP99 = std::atof(value());
+		else if (arg == "--min-output-rate")
+			options.minOutputRate = std::atof(value());
+		else if (arg == "--help" || arg == "-h") {
+			PrintUsage();
+			std::exit(0);
+		} else {
+			std::fprintf(stderr, "Unknown option %s\n", arg.c_str());
+			PrintUsage();
+			std::exit(1);
+		}
+	}
+
+	if (options.refreshRate <= 0.0) {
+		std::fprintf(stderr, "Refresh rate must be positive\n");
+		std::exit(1);
+	}
+
+	return options;
+}
+
+int main(int argc, char** argv)
+{
+	Options options = ParseOptions(argc, argv);
+
+	Random random(options.seed);
+	auto trace = BuildTrace(options, random);
+
+	VirtualClock clock(random, MsToTicks(options.wakeLatency));
+	PreciseSleeper<VirtualClock> sleeper(clock);
+	sleeper.SetSpinMargin(options.spinMargin);
+
+	FramePacer framePacer;
+	FramePacer gameFramePacer;
+
+	VRRMarginController vrrController;
+	vrrController.SetRefreshRate(options.refreshRate);
+	int64_t refreshTicks = MsToTicks(1000.0 / options.refreshRate);
+	int64_t lastRealScan = 0;
+
+	FrameTimePredictor frameTimePredictor;
+
+	auto sleep = [&](int64_t a_target) { sleeper.SleepUntil(a_target); };
+
+	Display display(refreshTicks, options.vsync, options.maxQueued);
+	size_t framesPerPresent = options.frameGeneration ? 2 : 1;
+
+	std::vector<double> latencies;
+	std::vector<double> addedLatencies;
+	std::vector<double> limiterSleeps;
+	std::vector<double> predictionErrors;
+	std::vector<double> midpointErrors;
+	size_t warmupIntervals = 0;
+	int64_t lastPresent = 0;
+	int64_t reportStart = 0;
+
+	for (size_t i = 0; i < trace.size(); i++) {
+		if (i == options.warmup) {
+			warmupIntervals = display.intervals.size();
+			reportStart = clock.Now();
+			sleeper.stats.Reset();
+		}
+
+		// Input is sampled at the start of the frame, then the game renders it
+		int64_t frameStart = clock.Now();
+		clock.Advance(MsToTicks(trace[i]));
+		int64_t frameReady = clock.Now();
+
+		// Frame generation shows the interpolated frame, then the real frame half a frame later
+		int64_t frameTimeDelta = frameReady - lastPresent;
+		lastPresent = frameReady;
+
+		double prediction = frameTimePredictor.GetPrediction();
+		if (i >= options.warmup && prediction > 0.0)
+			predictionErrors.push_back(std::abs(TicksToMs(frameTimeDelta) - prediction));
+
+		frameTimePredictor.AddSample(TicksToMs(frameTimeDelta));
+		if (options.predictive)
+			frameTimeDelta = MsToTicks(frameTimePredictor.GetPrediction());
+
+		int64_t realScan;
+		if (options.frameGeneration) {
+			int64_t generatedScan = display.Schedule(frameReady);
+			realScan = display.Schedule(std::max(generatedScan, frameReady + frameTimeDelta / 2));
+
+			if (i >= options.warmup && lastRealScan)
+				midpointErrors.push_back(std::abs(TicksToMs(generatedScan - (lastRealScan + realScan) / 2)));
+		} else {
+			realScan = display.Schedule(frameReady);
+		}
+
+		display.Backpressure(clock, framesPerPresent);
+
+		// Present statistics as GetFrameStatistics would report them
+		if (lastRealScan)
+			vrrController.Update(uint32_t(framesPerPresent), realScan - lastRealScan, refreshTicks);
+		lastRealScan = realScan;
+
+		// Same order as DX12SwapChain::Present
+		int64_t sleepStart = clock.Now();
+
+		if (options.gameLimiter)
+			gameFramePacer.Limit(clock, FramePacer::GetTargetInterval(kFrequency, 60.0, false), sleep);
+
+		if (!options.vsync) {
+			int64_t targetFrameTicks = 0;
+			if (options.frameLimit) {
+				double targetRate = options.adaptive ? vrrController.GetTargetRate() : FramePacer::GetVRRTargetRate(options.refreshRate);
+				targetFrameTicks = FramePacer::GetTargetInterval(kFrequency, targetRate, options.frameGeneration);
+
+				if (options.frameGeneration && options.predictive)
+					targetFrameTicks = std::max(targetFrameTicks, MsToTicks(frameTimePredictor.GetPrediction() * kPredictionSlack));
+			}
+			framePacer.Limit(clock, targetFrameTicks, sleep);
+		}
+
+		if (i >= options.warmup) {
+			latencies.push_back(TicksToMs(realScan - frameStart));
+			addedLatencies.push_back(TicksToMs(realScan - frameReady));
+			limiterSleeps.push_back(TicksToMs(clock.Now() - sleepStart));
+		}
+	}
+
+	std::vector<double> intervals;
+	for (size_t i = warmupIntervals; i < display.intervals.size(); i++)
+		intervals.push_back(TicksToMs(display.intervals[i]));
+
+	if (intervals.size() < 2) {
+		std::fprintf(stderr, "Not enough frames after warmup\n");
+		return 1;
+	}
+
+	std::vector<double> judder;
+	for (size_t i = 1; i < intervals.size(); i++)
+		judder.push_back(std::abs(intervals[i] - intervals[i - 1]));
+
+	double mean = Mean(intervals);
+	double variance = 0.0;
+	for (double interval : intervals)
+		variance += (interval - mean) * (interval - mean);
+	variance /= double(intervals.size());
+
+	double elapsed = TicksToMs(clock.Now() - reportStart);
+	auto& stats = sleeper.stats;
+
+	std::printf("frames            %zu (%zu warmup)\n", trace.size(), std::min(options.warmup, trace.size()));
+	std::printf("refresh           %.2f Hz%s%s\n", options.refreshRate, options.vsync ? " vsync" : " vrr", options.frameGeneration ? " framegen" : "");
+	double outputRate = double(intervals.size()) * 1000.0 / elapsed;
+	std::printf("output rate       %.2f fps\n", outputRate);
+	std::printf("interval ms       mean %.3f  p50 %.3f  p99 %.3f  p99.9 %.3f  stddev %.3f\n",
+		mean, Percentile(intervals, 50.0), Percentile(intervals, 99.0), Percentile(intervals, 99.9), std::sqrt(variance));
+	std::printf("judder ms         mean %.3f  p99 %.3f  p99.9 %.3f\n",
+		Mean(judder), Percentile(judder, 99.0), Percentile(judder, 99.9));
+	std::printf("latency ms        mean %.3f  p50 %.3f  p99 %.3f\n",
+		Mean(latencies), Percentile(latencies, 50.0), Percentile(latencies, 99.0));
+	std::printf("added latency ms  mean %.3f  p50 %.3f  p99 %.3f\n",
+		Mean(addedLatencies), Percentile(addedLatencies, 50.0), Percentile(addedLatencies, 99.0));
+	std::printf("limiter sleep ms  mean %.3f  p99 %.3f\n",
+		Mean(limiterSleeps), Percentile(limiterSleeps, 99.0));
+
+	std::printf("prediction err ms mean %.3f  p99 %.3f\n",
+		Mean(predictionErrors), Percentile(predictionErrors, 99.0));
+
+	if (options.frameGeneration) {
+		std::printf("midpoint err ms   mean %.3f  p99 %.3f\n",
+			Mean(midpointErrors), Percentile(midpointErrors, 99.0));
+	}
+
+	if (options.adaptive)
+		std::printf("vrr margin        %.2f%% (target %.2f Hz)\n", vrrController.margin * 100.0, vrrController.GetTargetRate());
+
+	if (stats.count) {
+		std::printf("sleep overshoot   mean %.3f ms  max %.3f ms  spin mean %.3f ms\n",
+			TicksToMs(stats.totalOvershootTicks) / double(stats.count),
+			TicksToMs(stats.maxOvershootTicks),
+			TicksToMs(stats.totalSpinTicks) / double(stats.count));
+	}
+
+	bool failed = false;
+	auto check = [&](bool a_passed, const char* a_metric, double a_value, double a_limit) {
+		if (a_passed)
+			return;
+		std::printf("FAIL              %s %.3f, limit %.3f\n", a_metric, a_value, a_limit);
+		failed = true;
+	};
+
+	if (options.maxMidpointP99 > 0.0 && options.frameGeneration) {
+		double value = Percentile(midpointErrors, 99.0);
+		check(value <= options.maxMidpointP99, "midpoint err p99", value, options.maxMidpointP99);
+	}
+	if (options.maxJudderP99 > 0.0) {
+		double value = Percentile(judder, 99.0);
+		check(value <= options.maxJudderP99, "judder p99", value, options.maxJudderP99);
+	}
+	if (options.minOutputRate > 0.0)
+		check(outputRate >= options.minOutputRate, "output rate", outputRate, options.minOutputRate);
+
+	return failed ? kExitLimitExceeded : 0;
+}
@@ -0,0 +1,424 @@
+// Frame generation input error metrics
+//
+// Reads the depth and motion vectors captured with iCaptureInterval and reports how much
+// precision the reduced shared formats lose, either simulated on a full precision capture
+// or measured between the full and shared precision captures of the same frame.
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+
+// DXGI_FORMAT values of the formats the plugin shares
+enum Format : uint32_t
+{
+	kR32G32_FLOAT = 16,
+	kR32G32_UINT = 17,
+	kR16G16_FLOAT = 34,
+	kR32_FLOAT = 41,
+	kR16_FLOAT = 54,
+	kR16_UNORM = 56
+};
+
+struct Image
+{
+	uint32_t width = 0;
+	uint32_t height = 0;
+	uint32_t channels = 0;
+	uint32_t bytesPerPixel = 0;
+	std::vector<float> texels;
+
+	float Get(size_t a_pixel, uint32_t a_channel) const { return texels[a_pixel * channels + a_channel]; }
+	size_t PixelCount() const { return size_t(width) * height; }
+};
+
+static float HalfToFloat(uint16_t a_half)
+{
+	uint32_t sign = uint32_t(a_half & 0x8000) << 16;
+	uint32_t exponent = (a_half >> 10) & 0x1F;
+	uint32_t mantissa = a_half & 0x3FF;
+
+	uint32_t bits;
+	if (exponent == 0x1F) {
+		bits = sign | 0x7F800000 | (mantissa << 13);
+	} else if (exponent) {
+		bits = sign | ((exponent + 112) << 23) | (mantissa << 13);
+	} else if (mantissa) {
+		// Denormal, renormalise into a float
+		exponent = 113;
+		while (!(mantissa & 0x400)) {
+			mantissa <<= 1;
+			exponent--;
+		}
+		bits = sign | (exponent << 23) | ((mantissa & 0x3FF) << 13);
+	} else {
+		bits = sign;
+	}
+
+	float value;
+	std::memcpy(&value, &bits, sizeof(value));
+	return value;
+}
+
+// Round to nearest even, the same as a typed UAV store or f32tof16
+static uint16_t FloatToHalf(float a_value)
+{
+	uint32_t bits;
+	std::memcpy(&bits, &a_value, sizeof(bits));
+
+	uint32_t sign = (bits >> 16) & 0x8000;
+	uint32_t magnitude = bits & 0x7FFFFFFF;
+
+	if (magnitude >= 0x7F800000)
+		return uint16_t(sign | 0x7C00 | (magnitude > 0x7F800000 ? 0x200 : 0));
+	if (magnitude >= 0x477FF000)
+		return uint16_t(sign | 0x7C00);
+
+	if (magnitude < 0x38800000) {
+		// Denormal or zero
+		if (magnitude < 0x33000000)
+			return uint16_t(sign);
+		uint32_t shift = 113 - (magnitude >> 23);
+		uint32_t mantissa = (magnitude & 0x7FFFFF) | 0x800000;
+		uint32_t half = mantissa >> (shift + 13);
+		uint32_t remainder = mantissa & ((1u << (shift + 13)) - 1);
+		uint32_t halfway = 1u << (shift + 12);
+		if (remainder > halfway || (remainder == halfway && (half & 1)))
+			half++;
+		return uint16_t(sign | half);
+	}
+
+	uint32_t half = ((magnitude - 0x38000000) >> 13);
+	uint32_t remainder = magnitude & 0x1FFF;
+	if (remainder > 0x1000 || (remainder == 0x1000 && (half & 1)))
+		half++;
+	return uint16_t(sign | half);
+}
+
+static float QuantizeHalf(float a_value)
+{
+	return HalfToFloat(FloatToHalf(a_value));
+}
+
+static float QuantizeUnorm16(float a_value)
+{
+	return std::round(std::clamp(a_value, 0.0f, 1.0f) * 65535.0f) / 65535.0f;
+}
+
+template <class T>
+static T Read(const std::vector<uint8_t>& a_data, size_t a_offset)
+{
+	T value;
+	std::memcpy(&value, a_data.data() + a_offset, sizeof(T));
+	return value;
+}
+
+static uint32_t MakeFourCC(char a, char b, char c, char d)
+{
+	return uint32_t(uint8_t(a)) | (uint32_t(uint8_t(b)) << 8) | (uint32_t(uint8_t(c)) << 16) | (uint32_t(uint8_t(d)) << 24);
+}
+
+// Packed captures are split into a depth image and a motion vector image
+static std::vector<Image> LoadDDS(const std::string& a_path)
+{
+	std::ifstream file(a_path, std::ios::binary);
+	if (!file) {
+		std::fprintf(stderr, "Failed to open %s\n", a_path.c_str());
+		std::exit(1);
+	}
+
+	std::vector<uint8_t> data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+	// Magic, 124 byte header, optional 20 byte DX10 header
+	if (data.size() < 128 || Read<uint32_t>(data, 0) != MakeFourCC('D', 'D', 'S', ' ')) {
+		std::fprintf(stderr, "%s is not a DDS file\n", a_path.c_str());
+		std::exit(1);
+	}
+
+	uint32_t height = Read<uint32_t>(data, 12);
+	uint32_t width = Read<uint32_t>(data, 16);
+	uint32_t fourCC = Read<uint32_t>(data, 84);
+
+	size_t offset = 128;
+	uint32_t format = 0;
+	if (fourCC == MakeFourCC('D', 'X', '1', '0')) {
+		format = Read<uint32_t>(data, 128);
+		offset += 20;
+	} else if (fourCC == 111) {
+		format = kR16_FLOAT;
+	} else if (fourCC == 112) {
+		format = kR16G16_FLOAT;
+	} else if (fourCC == 114) {
+		format = kR32_FLOAT;
+	} else if (fourCC == 115) {
+		format = kR32G32_FLOAT;
+	}
+
+	uint32_t bytesPerPixel = 0;
+	switch (format) {
+	case kR16_FLOAT:
+	case kR16_UNORM:
+		bytesPerPixel = 2;
+		break;
+	case kR32_FLOAT:
+	case kR16G16_FLOAT:
+		bytesPerPixel = 4;
+		break;
+	case kR32G32_FLOAT:
+	case kR32G32_UINT:
+		bytesPerPixel = 8;
+		break;
+	default:
+		std::fprintf(stderr, "%s has unsupported format %u\n", a_path.c_str(), format);
+		std::exit(1);
+	}
+
+	size_t pixelCount = size_t(width) * height;
+	if (data.size() < offset + pixelCount * bytesPerPixel) {
+		std::fprintf(stderr, "%s is truncated\n", a_path.c_str());
+		std::exit(1);
+	}
+
+	Image depth{ width, height, 1, format == kR32G32_UINT ? 4u : bytesPerPixel, {} };
+	Image motionVectors{ width, height, 2, format == kR32G32_UINT ? 4u : bytesPerPixel, {} };
+
+	for (size_t i = 0; i < pixelCount; i++) {
+		size_t texel = offset + i * bytesPerPixel;
+		switch (format) {
+		case kR16_FLOAT:
+			depth.texels.push_back(HalfToFloat(Read<uint16_t>(data, texel)));
+			break;
+		case kR16_UNORM:
+			depth.texels.push_back(float(Read<uint16_t>(data, texel)) / 65535.0f);
+			break;
+		case kR32_FLOAT:
+			depth.texels.push_back(Read<float>(data, texel));
+			break;
+		case kR16G16_FLOAT:
+			motionVectors.texels.push_back(HalfToFloat(Read<uint16_t>(data, texel)));
+			motionVectors.texels.push_back(HalfToFloat(Read<uint16_t>(data, texel + 2)));
+			break;
+		case kR32G32_FLOAT:
+			motionVectors.texels.push_back(Read<float>(data, texel));
+			motionVectors.texels.push_back(Read<float>(data, texel + 4));
+			break;
+		case kR32G32_UINT:
+			// Same layout as DepthMotionVectors.hlsli
+			depth.texels.push_back(Read<float>(data, texel));
+			motionVectors.texels.push_back(HalfToFloat(Read<uint16_t>(data, texel + 4)));
+			motionVectors.texels.push_back(HalfToFloat(Read<uint16_t>(data, texel + 6)));
+			break;
+		}
+	}
+
+	std::vector<Image> images;
+	if (!depth.texels.empty())
+		images.push_back(std::move(depth));
+	if (!motionVectors.texels.empty())
+		images.push_back(std::move(motionVectors));
+	return images;
+}
+
+static double Percentile(std::vector<double> a_values, double a_percentile)
+{
+	if (a_values.empty())
+		return 0.0;
+
+	size_t rank = std::min(a_values.size() - 1, size_t(a_percentile / 100.0 * double(a_values.size() - 1)));
+	std::nth_element(a_values.begin(), a_values.begin() + rank, a_values.end());
+	return a_values[rank];
+}
+
+struct Options
+{
+	std::vector<std::string> captures;
+	std::vector<std::string> compareFrames;
+	bool pixels = true;
+};
+
+// Depth errors are absolute, plus how often the order of two neighbouring depths changes, which is what dilation picks on
+static void ReportDepth(const char* a_label, const Image& a_reference, const Image& a_test)
+{
+	std::vector<double> errors;
+	errors.reserve(a_reference.PixelCount());
+
+	double sum = 0.0;
+	double sumSquares = 0.0;
+	double max = 0.0;
+	size_t orderFlips = 0;
+	size_t orderPairs = 0;
+
+	for (uint32_t y = 0; y < a_reference.height; y++) {
+		for (uint32_t x = 0; x < a_reference.width; x++) {
+			size_t pixel = size_t(y) * a_reference.width + x;
+			double error = std::abs(double(a_test.Get(pixel, 0)) - double(a_reference.Get(pixel, 0)));
+			errors.push_back(error);
+			sum += error;
+			sumSquares += error * error;
+			max = std::max(max, error);
+
+			if (x + 1 < a_reference.width) {
+				float reference = a_reference.Get(pixel, 0) - a_reference.Get(pixel + 1, 0);
+				float test = a_test.Get(pixel, 0) - a_test.Get(pixel + 1, 0);
+				if (reference != 0.0f) {
+					orderPairs++;
+					if ((reference > 0.0f) != (test > 0.0f))
+						orderFlips++;
+				}
+			}
+		}
+	}
+
+	double count = double(errors.size());
+	std::printf("  %-18s mean %.3e  rms %.3e  p99 %.3e  max %.3e  order flips %.4f%%  %u bytes/px\n",
+		a_label, sum / count, std::sqrt(sumSquares / count), Percentile(errors, 99.0), max,
+		orderPairs ? double(orderFlips) * 100.0 / double(orderPairs) : 0.0, a_test.bytesPerPixel);
+}
+
+// Motion vectors are in UV units, reported in pixels of the captured size unless asked otherwise
+static void ReportMotionVectors(const char* a_label, const Image& a_reference, const Image& a_test, bool a_pixels)
+{
+	double scaleX = a_pixels ? double(a_reference.width) : 1.0;
+	double scaleY = a_pixels ? double(a_reference.height) : 1.0;
+
+	std::vector<double> errors;
+	errors.reserve(a_reference.PixelCount());
+
+	double sum = 0.0;
+	double max = 0.0;
+
+	for (size_t pixel = 0; pixel < a_reference.PixelCount(); pixel++) {
+		double dx = (double(a_test.Get(pixel, 0)) - double(a_reference.Get(pixel, 0))) * scaleX;
+		double dy = (double(a_test.Get(pixel, 1)) - double(a_reference.Get(pixel, 1))) * scaleY;
+		double error = std::sqrt(dx * dx + dy * dy);
+		errors.push_back(error);
+		sum += error;
+		max = std::max(max, error);
+	}
+
+	std::printf("  %-18s mean %.3e  p99 %.3e  p99.9 %.3e  max %.3e %s  %u bytes/px\n",
+		a_label, sum / double(errors.size()), Percentile(errors, 99.0), Percentile(errors, 99.9), max,
+		a_pixels ? "px" : "uv", a_test.bytesPerPixel);
+}
+
+static Image Quantize(const Image& a_image, float (*a_quantize)(float), uint32_t a_bytesPerPixel)
+{
+	Image quantized = a_image;
+	quantized.bytesPerPixel = a_bytesPerPixel;
+	for (auto& texel : quantized.texels)
+		texel = a_quantize(texel);
+	return quantized;
+}
+
+static void Simulate(const std::string& a_path, bool a_pixels)
+{
+	for (auto& image : LoadDDS(a_path)) {
+		std::printf("%s %ux%u %s\n", a_path.c_str(), image.width, image.height, image.channels == 1 ? "depth" : "motion vectors");
+
+		if (image.channels == 1) {
+			ReportDepth("R16_FLOAT", image, Quantize(image, QuantizeHalf, 2));
+			ReportDepth("R16_UNORM", image, Quantize(image, QuantizeUnorm16, 2));
+		} else if (image.bytesPerPixel > 4) {
+			ReportMotionVectors("R16G16_FLOAT", image, Quantize(image, QuantizeHalf, 4), a_pixels);
+		} else {
+			std::printf("  already half precision, nothing to simulate\n");
+		}
+	}
+}
+
+static void Compare(const std::string& a_reference, const std::string& a_test, bool a_pixels)
+{
+	// A capture cut short, e.g. by a failed write, skips only its own pair
+	if (!std::filesystem::exists(a_reference) || !std::filesystem::exists(a_test)) {
+		std::printf("%s or %s missing, skipped\n", a_reference.c_str(), a_test.c_str());
+		return;
+	}
+
+	auto references = LoadDDS(a_reference);
+	auto tests = LoadDDS(a_test);
+
+	for (auto& reference : references) {
+		auto test = std::find_if(tests.begin(), tests.end(), [&](const Image& a_image) { return a_image.channels == reference.channels; });
+		if (test == tests.end())
+			continue;
+
+		if (test->width != reference.width || test->height != reference.height) {
+			std::fprintf(stderr, "%s and %s differ in size\n", a_reference.c_str(), a_test.c_str());
+			std::exit(1);
+		}
+
+		std::printf("%s vs %s %ux%u %s\n", a_test.c_str(), a_reference.c_str(), reference.width, reference.height, reference.channels == 1 ? "depth" : "motion vectors");
+
+		if (reference.channels == 1)
+			ReportDepth("measured", reference, *test);
+		else
+			ReportMotionVectors("measured", reference, *test, a_pixels);
+	}
+}
+
+// The plugin writes both precisions of a capture frame from the same game data, so only the format differs
+static void CompareFrame(const std::string& a_frame, bool a_pixels)
+{
+	for (const char* name : { "depth", "motionvectors" })
+		Compare(a_frame + "_" + name + "_full.dds", a_frame + "_" + name + ".dds", a_pixels);
+}
+
+static void PrintUsage()
+{
+	std::printf(
+		"Usage: InputErrorMetrics [options] <capture.dds>...\n"
+		"  <capture.dds>                 full precision capture, the reduced formats are simulated on it\n"
+		"  --compare <frame>             measure <frame>_*.dds against <frame>_*_full.dds, e.g. Captures/000600\n"
+		"  --uv                          report motion vector errors in UV units instead of pixels\n"
+		"  --help                        show this message\n");
+}
+
+static Options ParseOptions(int argc, char** argv)
+{
+	Options options;
+
+	for (int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+
+		if (arg == "--compare" && i + 1 < argc) {
+			options.compareFrames.push_back(argv[++i]);
+		} else if (arg == "--uv") {
+			options.pixels = false;
+		} else if (arg == "--help" || arg == "-h") {
+			PrintUsage();
+			std::exit(0);
+		} else if (!arg.empty() && arg[0] != '-') {
+			options.captures.push_back(arg);
+		} else {
+			std::fprintf(stderr, "Unknown option %s\n", arg.c_str());
+			PrintUsage();
+			std::exit(1);
+		}
+	}
+
+	if (options.captures.empty() && options.compareFrames.empty()) {
+		PrintUsage();
+		std::exit(1);
+	}
+
+	return options;
+}
+
+int main(int argc, char** argv)
+{
+	Options options = ParseOptions(argc, argv);
+
+	for (auto& capture : options.captures)
+		Simulate(capture, options.pixels);
+
+	for (auto& frame : options.compareFrames)
+		CompareFrame(frame, options.pixels);
+
+	return 0;
+}
@@ -0,0 +1,237 @@
+// PreciseSleeper tests
+//
+// Drives PreciseSleeper with a fake clock that records every coarse wait and spin iteration,
+// and checks how a wait is split between the OS timer and the spin for punctual and late timers.
+
+#include <cstdio>
+#include <cstring>
+
+#include "PreciseSleep.h"
+
+static constexpr int64_t kFrequency = 10'000'000;
+
+// Time only moves when the sleeper blocks or spins
+class FakeClock
+{
+public:
+	int64_t Now() { return now; }
+	int64_t Frequency() const { return kFrequency; }
+
+	void Block(int64_t a_ticks)
+	{
+		blockCalls++;
+		blockRequested += a_ticks;
+		now += a_ticks + wakeLatency;
+	}
+
+	void Pause()
+	{
+		pauses++;
+		now += pauseTicks;
+	}
+
+	int64_t now = 0;
+
+	// How late the OS timer wakes up and how long one spin iteration takes
+	int64_t wakeLatency = 0;
+	int64_t pauseTicks = 5;
+
+	int blockCalls = 0;
+	int64_t blockRequested = 0;
+	int pauses = 0;
+};
+
+static int failures = 0;
+
+#define CHECK(condition)                                                                  \
+	do {                                                                                  \
+		if (!(condition)) {                                                               \
+			std::printf("  %s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #condition); \
+			failures++;                                                                   \
+		}                                                                                 \
+	} while (0)
+
+static int64_t MsToTicks(double a_ms)
+{
+	return int64_t(a_ms * double(kFrequency) / 1000.0);
+}
+
+// The INI value in milliseconds becomes clock ticks, never negative
+static void TestSpinMargin()
+{
+	FakeClock clock;
+	PreciseSleeper<FakeClock> sleeper(clock);
+
+	sleeper.SetSpinMargin(0.75);
+	CHECK(sleeper.GetSpinMargin() == MsToTicks(0.75));
+
+	sleeper.SetSpinMargin(-1.0);
+	CHECK(sleeper.GetSpinMargin() == 0);
+}
+
+// A deadline already passed neither blocks nor spins nor counts as a wait
+static void TestPastDeadline()
+{
+	FakeClock clock;
+	clock.now = 1000;
+	PreciseSleeper<FakeClock> sleeper(clock);
+	sleeper.SetSpinMargin(0.75);
+
+	CHECK(sleeper.SleepUntil(1000) == 0);
+	CHECK(sleeper.SleepUntil(500) == 0);
+	CHECK(clock.blockCalls == 0);
+	CHECK(clock.pauses == 0);
+	CHECK(sleeper.stats.count == 0);
+}
+
+// Shorter than the margin, the OS timer is too coarse to be used at all
+static void TestSpinOnly()
+{
+	FakeClock clock;
+	PreciseSleeper<FakeClock> sleeper(clock);
+	sleeper.SetSpinMargin(0.75);
+
+	int64_t target = MsToTicks(0.5);
+	CHECK(sleeper.SleepUntil(target) == clock.now);
+	CHECK(clock.blockCalls == 0);
+	CHECK(clock.pauses > 0);
+	CHECK(sleeper.stats.blockedTicks == 0);
+	CHECK(sleeper.stats.spinTicks == clock.now);
+	CHECK(sleeper.stats.overshootTicks >= 0 && sleeper.stats.overshootTicks < clock.pauseTicks);
+}
+
+// A punctual timer covers everything but the margin, the margin is spun
+static void TestBlockThenSpin()
+{
+	FakeClock clock;
+	PreciseSleeper<FakeClock> sleeper(clock);
+	sleeper.SetSpinMargin(0.75);
+
+	int64_t target = MsToTicks(5.0);
+	sleeper.SleepUntil(target);
+
+	CHECK(clock.blockCalls == 1);
+	CHECK(clock.blockRequested == target - sleeper.GetSpinMargin());
+	CHECK(sleeper.stats.requestedTicks == target);
+	CHECK(sleeper.stats.blockedTicks == target - sleeper.GetSpinMargin());
+	CHECK(sleeper.stats.spinTicks >= sleeper.GetSpinMargin());
+	CHECK(sleeper.stats.overshootTicks >= 0 && sleeper.stats.overshootTicks < clock.pauseTicks);
+	CHECK(clock.pauses == int((sleeper.GetSpinMargin() + clock.pauseTicks - 1) / clock.pauseTicks));
+}
+
+// A timer that wakes late within the margin only shortens the spin
+static void TestLateWithinMargin()
+{
+	FakeClock clock;
+	clock.wakeLatency = MsToTicks(0.5);
+	PreciseSleeper<FakeClock> sleeper(clock);
+	sleeper.SetSpinMargin(0.75);
+
+	int64_t target = MsToTicks(5.0);
+	sleeper.SleepUntil(target);
+
+	CHECK(clock.blockCalls == 1);
+	CHECK(sleeper.stats.blockedTicks == target - sleeper.GetSpinMargin() + clock.wakeLatency);
+	CHECK(sleeper.stats.spinTicks >= sleeper.GetSpinMargin() - clock.wakeLatency);
+	CHECK(sleeper.stats.spinTicks < sleeper.GetSpinMargin() - clock.wakeLatency + clock.pauseTicks);
+	CHECK(sleeper.stats.overshootTicks < clock.pauseTicks);
+}
+
+// A timer later than the margin overshoots by the difference and skips the spin
+static void TestLatePastMargin()
+{
+	FakeClock clock;
+	clock.wakeLatency = MsToTicks(1.0);
+	PreciseSleeper<FakeClock> sleeper(clock);
+	sleeper.SetSpinMargin(0.75);
+
+	int64_t target = MsToTicks(5.0);
+	CHECK(sleeper.SleepUntil(target) == target + clock.wakeLatency - sleeper.GetSpinMargin());
+
+	CHECK(clock.pauses == 0);
+	CHECK(sleeper.stats.spinTicks == 0);
+	CHECK(sleeper.stats.overshootTicks == clock.wakeLatency - sleeper.GetSpinMargin());
+}
+
+// Without a margin the whole wait is left to the timer
+static void TestNoMargin()
+{
+	FakeClock clock;
+	PreciseSleeper<FakeClock> sleeper(clock);
+	sleeper.SetSpinMargin(0.0);
+
+	int64_t target = MsToTicks(2.0);
+	sleeper.SleepUntil(target);
+
+	CHECK(clock.blockCalls == 1);
+	CHECK(clock.blockRequested == target);
+	CHECK(clock.pauses == 0);
+	CHECK(sleeper.stats.overshootTicks == 0);
+}
+
+// Aggregates add up over waits and Reset clears them but keeps the last wait
+static void TestStats()
+{
+	FakeClock clock;
+	PreciseSleeper<FakeClock> sleeper(clock);
+	sleeper.SetSpinMargin(0.75);
+
+	clock.wakeLatency = MsToTicks(1.0);
+	sleeper.SleepUntil(clock.now + MsToTicks(5.0));
+	clock.wakeLatency = MsToTicks(2.0);
+	sleeper.SleepUntil(clock.now + MsToTicks(5.0));
+	clock.wakeLatency = 0;
+	sleeper.SleepUntil(clock.now + MsToTicks(5.0));
+
+	int64_t margin = sleeper.GetSpinMargin();
+	CHECK(sleeper.stats.count == 3);
+	CHECK(sleeper.stats.maxOvershootTicks == MsToTicks(2.0) - margin);
+	CHECK(sleeper.stats.totalOvershootTicks == MsToTicks(1.0) - margin + MsToTicks(2.0) - margin + sleeper.stats.overshootTicks);
+	CHECK(sleeper.stats.totalSpinTicks == sleeper.stats.spinTicks);
+
+	sleeper.stats.Reset();
+	CHECK(sleeper.stats.count == 0);
+	CHECK(sleeper.stats.totalOvershootTicks == 0);
+	CHECK(sleeper.stats.maxOvershootTicks == 0);
+	CHECK(sleeper.stats.totalSpinTicks == 0);
+	CHECK(sleeper.stats.requestedTicks == MsToTicks(5.0));
+}
+
+struct Test
+{
+	const char* name;
+	void (*func)();
+};
+
+static constexpr Test kTests[] = {
+	{ "spin_margin", TestSpinMargin },
+	{ "past_deadline", TestPastDeadline },
+	{ "spin_only", TestSpinOnly },
+	{ "block_then_spin", TestBlockThenSpin },
+	{ "late_within_margin", TestLateWithinMargin },
+	{ "late_past_margin", TestLatePastMargin },
+	{ "no_margin", TestNoMargin },
+	{ "stats", TestStats },
+};
+
+int main(int argc, char** argv)
+{
+	int run = 0;
+
+	for (auto& test : kTests) {
+		if (argc > 1 && std::strcmp(argv[1], test.name) != 0)
+			continue;
+
+		int before = failures;
+		test.func();
+		std::printf("%s: %s\n", test.name, failures == before ? "passed" : "FAILED");
+		run++;
+	}
+
+	if (!run) {
+		std::printf("Unknown test %s\n", argv[1]);
+		return 2;
+	}
+
+	return failures ? 1 : 0;
+}
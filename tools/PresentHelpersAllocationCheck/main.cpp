@@ -0,0 +1,240 @@
+// Present helpers allocation check
+//
+// Replaces the global allocator with a counting one and calls the platform independent helpers
+// DX12SwapChain::Present and the frame limiter use every frame (FrameRing, ResourceStateTrackerCore,
+// FramePacer, PreciseSleeper, VRRMarginController) in roughly the order Present does, on a virtual
+// clock. Fails when any frame after the warmup allocates.
+//
+// This does not run Present itself. DX12SwapChain, FidelityFX, GPUProfiler, Telemetry and LowLatency
+// need D3D and are only watched by AllocationGuard in Debug builds of the plugin.
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <string>
+
+#include "FramePacing.h"
+#include "FrameRing.h"
+#include "PreciseSleep.h"
+#include "ResourceStateTrackerCore.h"
+
+static bool counting = false;
+static uint64_t allocations = 0;
+
+static void* CountedAlloc(std::size_t a_size) noexcept
+{
+	if (counting)
+		allocations++;
+
+	return std::malloc(a_size ? a_size : 1);
+}
+
+static void* CountedAllocOrThrow(std::size_t a_size)
+{
+	if (void* p = CountedAlloc(a_size))
+		return p;
+	throw std::bad_alloc();
+}
+
+void* operator new(std::size_t a_size) { return CountedAllocOrThrow(a_size); }
+void* operator new[](std::size_t a_size) { return CountedAllocOrThrow(a_size); }
+void* operator new(std::size_t a_size, const std::nothrow_t&) noexcept { return CountedAlloc(a_size); }
+void* operator new[](std::size_t a_size, const std::nothrow_t&) noexcept { return CountedAlloc(a_size); }
+void operator delete(void* a_p) noexcept { std::free(a_p); }
+void operator delete[](void* a_p) noexcept { std::free(a_p); }
+void operator delete(void* a_p, std::size_t) noexcept { std::free(a_p); }
+void operator delete[](void* a_p, std::size_t) noexcept { std::free(a_p); }
+
+static constexpr int64_t kFrequency = 10'000'000;
+
+// Deterministic, OS timers wake up late by a varying amount
+class VirtualClock
+{
+public:
+	int64_t Now() { return now; }
+	int64_t Frequency() const { return kFrequency; }
+
+	void Block(int64_t a_ticks) { now += a_ticks + int64_t((step++ * 7919) % 3000); }
+	void Pause() { now += 5; }
+
+	void Advance(int64_t a_ticks) { now += a_ticks; }
+
+private:
+	int64_t now = 0;
+	uint64_t step = 0;
+};
+
+struct Options
+{
+	size_t frames = 20000;
+	size_t warmup = 120;
+	uint32_t depth = 2;
+	double refreshRate = 144.0;
+	bool frameGeneration = false;
+
+	// Allocates once per frame inside the counted region, for checking the check
+	bool allocate = false;
+};
+
+static void PrintUsage()
+{
+	std::printf(
+		"Usage: PresentHelpersAllocationCheck [options]\n"
+		"  --frames N       frames counted after the warmup (20000)\n"
+		"  --warmup N       frames run before counting starts (120)\n"
+		"  --depth N        frame ring depth (2)\n"
+		"  --refresh HZ     display refresh rate (144)\n"
+		"  --framegen       pace for frame generation\n"
+		"  --allocate       allocate every frame, the check must fail\n");
+}
+
+static Options ParseOptions(int argc, char** argv)
+{
+	Options options;
+
+	for (int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		auto next = [&]() -> const char* {
+			if (i + 1 >= argc) {
+				std::fprintf(stderr, "Missing value for %s\n", arg.c_str());
+				std::exit(2);
+			}
+			return argv[++i];
+		};
+
+		if (arg == "--frames")
+			options.frames = std::strtoull(next(), nullptr, 10);
+		else if (arg == "--warmup")
+			options.warmup = std::strtoull(next(), nullptr, 10);
+		else if (arg == "--depth")
+			options.depth = uint32_t(std::strtoul(next(), nullptr, 10));
+		else if (arg == "--refresh")
+			options.refreshRate = std::atof(next());
+		else if (arg == "--framegen")
+			options.frameGeneration = true;
+		else if (arg == "--allocate")
+			options.allocate = true;
+		else {
+			PrintUsage();
+			std::exit(arg == "--help" ? 0 : 2);
+		}
+	}
+
+	return options;
+}
+
+int main(int argc, char** argv)
+{
+	Options options = ParseOptions(argc, argv);
+
+	VirtualClock clock;
+	PreciseSleeper<VirtualClock> sleeper(clock);
+	sleeper.SetSpinMargin(0.75);
+
+	FramePacer framePacer;
+
+	VRRMarginController vrrController;
+	vrrController.SetRefreshRate(options.refreshRate);
+	int64_t refreshTicks = int64_t(double(kFrequency) / options.refreshRate);
+
+	FrameRing frameRing;
+	frameRing.SetDepth(options.depth);
+	frameRing.SetMaxFramesAhead(1);
+
+	// The FSR inputs of every slot, moved in and out of the read state around the dispatch as in FidelityFX::Present
+	enum class State
+	{
+		kCommon,
+		kShaderResource
+	};
+	struct Resource
+	{
+	};
+	Resource depth[FrameRing::kMaxDepth]{}, motionVectors[FrameRing::kMaxDepth]{};
+	ResourceStateTrackerCore<Resource, State> stateTracker;
+	for (uint32_t i = 0; i < FrameRing::kMaxDepth; i++) {
+		stateTracker.Track(&depth[i], State::kCommon);
+		stateTracker.Track(&motionVectors[i], State::kCommon);
+	}
+	size_t barriers = 0;
+	auto issue = [&](const auto*, size_t a_count) { barriers += a_count; };
+
+	FrameRing::WaitStats slotReuseWaits;
+	FrameRing::WaitStats framesAheadWaits;
+
+	// Stands in for the completion fence
+	uint64_t completedValue = 0;
+	int64_t frameTime = kFrequency / 90;
+
+	uint64_t frameAllocations = 0;
+	uint64_t worstFrame = 0;
+	uint64_t worstFrameAllocations = 0;
+	volatile int* sink = nullptr;
+
+	for (size_t frame = 0; frame < options.warmup + options.frames; frame++) {
+		bool counted = frame >= options.warmup;
+		uint64_t before = allocations;
+		counting = counted;
+
+		// DX12SwapChain::Present
+		uint32_t slot = uint32_t(frame % frameRing.GetDepth());
+		slotReuseWaits.Add(frameRing.GetReuseValue(slot) > completedValue ? frameTime : 0);
+
+		if (options.allocate)
+			sink = new int(int(frame));
+
+		stateTracker.Transition(&depth[slot], State::kShaderResource);
+		stateTracker.Transition(&motionVectors[slot], State::kShaderResource);
+		stateTracker.Flush(issue);
+		stateTracker.Transition(&depth[slot], State::kCommon);
+		stateTracker.Transition(&motionVectors[slot], State::kCommon);
+		stateTracker.Flush(issue);
+
+		uint64_t retired = frameRing.Retire(slot);
+		framesAheadWaits.Add(frameRing.GetFramesAheadValue() > completedValue ? frameTime : 0);
+
+		// Upscaling::FrameLimiter
+		double targetRate = vrrController.GetTargetRate();
+		int64_t interval = FramePacer::GetTargetInterval(kFrequency, targetRate, options.frameGeneration);
+		framePacer.Limit(clock, interval, [&](int64_t a_target) { sleeper.SleepUntil(a_target); });
+
+		// Upscaling::UpdateFrameStatistics
+		vrrController.Update(options.frameGeneration ? 2 : 1, interval, refreshTicks);
+
+		counting = false;
+
+		if (options.allocate) {
+			delete sink;
+			sink = nullptr;
+		}
+
+		// The GPU is one frame behind
+		clock.Advance(frameTime);
+		completedValue = retired - 1;
+
+		if (counted) {
+			uint64_t count = allocations - before;
+			frameAllocations += count;
+			if (count > worstFrameAllocations) {
+				worstFrameAllocations = count;
+				worstFrame = frame;
+			}
+		}
+	}
+
+	std::printf("Frames:               %zu (after %zu warmup)\n", options.frames, options.warmup);
+	std::printf("Ring depth:           %u\n", frameRing.GetDepth());
+	std::printf("Slot reuse waits:     %llu\n", (unsigned long long)slotReuseWaits.waits);
+	std::printf("Frames ahead waits:   %llu\n", (unsigned long long)framesAheadWaits.waits);
+	std::printf("Barriers:             %zu\n", barriers);
+	std::printf("Sleeps:               %llu\n", (unsigned long long)sleeper.stats.count);
+	std::printf("Heap allocations:     %llu\n", (unsigned long long)frameAllocations);
+
+	if (frameAllocations) {
+		std::printf("FAIL: frame %llu made %llu heap allocations\n", (unsigned long long)worstFrame, (unsigned long long)worstFrameAllocations);
+		return 1;
+	}
+
+	return 0;
+}
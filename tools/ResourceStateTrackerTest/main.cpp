@@ -0,0 +1,250 @@
+// ResourceStateTracker tests
+//
+// Drives the platform independent tracker core with mock resources and a mock command list
+// that records every ResourceBarrier call, and checks the barrier batches the plugin would issue.
+
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#include "ResourceStateTrackerCore.h"
+
+// Bit flags like D3D12_RESOURCE_STATES
+enum class State : uint32_t
+{
+	kCommon = 0,
+	kUnorderedAccess = 0x8,
+	kShaderResource = 0x40,
+	kCopyDest = 0x400,
+	kCopySource = 0x800,
+	kPresent = 0
+};
+
+struct Resource
+{
+	int id;
+};
+
+static constexpr size_t kCapacity = 4;
+using Tracker = ResourceStateTrackerCore<Resource, State, kCapacity>;
+
+class MockCommandList
+{
+public:
+	void ResourceBarrier(size_t a_count, const Tracker::PendingTransition* a_transitions)
+	{
+		calls.emplace_back(a_transitions, a_transitions + a_count);
+	}
+
+	std::vector<std::vector<Tracker::PendingTransition>> calls;
+};
+
+static void Flush(Tracker& a_tracker, MockCommandList& a_commandList)
+{
+	a_tracker.Flush([&](const Tracker::PendingTransition* a_transitions, size_t a_count) {
+		a_commandList.ResourceBarrier(a_count, a_transitions);
+	});
+}
+
+static int failures = 0;
+
+#define CHECK(condition)                                                                  \
+	do {                                                                                  \
+		if (!(condition)) {                                                               \
+			std::printf("  %s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #condition); \
+			failures++;                                                                   \
+		}                                                                                 \
+	} while (0)
+
+static bool IsTransition(const Tracker::PendingTransition& a_transition, const Resource* a_resource, State a_before, State a_after)
+{
+	return a_transition.resource == a_resource && a_transition.before == a_before && a_transition.after == a_after;
+}
+
+// One barrier per changed resource, all of them in a single call
+static void TestBatch()
+{
+	Tracker tracker;
+	MockCommandList commandList;
+	Resource a{ 0 }, b{ 1 };
+
+	tracker.Track(&a, State::kCommon);
+	tracker.Track(&b, State::kCommon);
+
+	CHECK(tracker.Transition(&a, State::kCopySource) == Tracker::Status::kOk);
+	CHECK(tracker.Transition(&b, State::kCopyDest) == Tracker::Status::kOk);
+	Flush(tracker, commandList);
+
+	CHECK(commandList.calls.size() == 1);
+	CHECK(commandList.calls[0].size() == 2);
+	CHECK(IsTransition(commandList.calls[0][0], &a, State::kCommon, State::kCopySource));
+	CHECK(IsTransition(commandList.calls[0][1], &b, State::kCommon, State::kCopyDest));
+	CHECK(tracker.GetState(&a, State::kCommon) == State::kCopySource);
+	CHECK(tracker.GetPendingCount() == 0);
+}
+
+// Transitions to the current state and empty flushes issue nothing
+static void TestRedundant()
+{
+	Tracker tracker;
+	MockCommandList commandList;
+	Resource a{ 0 };
+
+	tracker.Track(&a, State::kShaderResource);
+	CHECK(tracker.Transition(&a, State::kShaderResource) == Tracker::Status::kOk);
+	Flush(tracker, commandList);
+	Flush(tracker, commandList);
+
+	CHECK(commandList.calls.empty());
+}
+
+// Several transitions of one resource between flushes become one barrier, a round trip none
+static void TestMerge()
+{
+	Tracker tracker;
+	MockCommandList commandList;
+	Resource a{ 0 }, b{ 1 };
+
+	tracker.Track(&a, State::kCommon);
+	tracker.Track(&b, State::kCommon);
+
+	tracker.Transition(&a, State::kShaderResource);
+	tracker.Transition(&a, State::kUnorderedAccess);
+	tracker.Transition(&b, State::kCopySource);
+	tracker.Transition(&b, State::kCommon);
+	CHECK(tracker.GetPendingCount() == 1);
+	Flush(tracker, commandList);
+
+	CHECK(commandList.calls.size() == 1);
+	CHECK(commandList.calls[0].size() == 1);
+	CHECK(IsTransition(commandList.calls[0][0], &a, State::kCommon, State::kUnorderedAccess));
+	CHECK(tracker.GetState(&b, State::kCopyDest) == State::kCommon);
+}
+
+// The pre-recorded swap chain copy has to leave both resources as it found them
+static void TestReplayedCopy()
+{
+	Tracker tracker;
+	MockCommandList commandList;
+	Resource fakeSwapChain{ 0 }, realSwapChain{ 1 };
+
+	tracker.Track(&fakeSwapChain, State::kCommon);
+	tracker.Track(&realSwapChain, State::kPresent);
+
+	for (int i = 0; i < 3; i++) {
+		tracker.Transition(&fakeSwapChain, State::kCopySource);
+		tracker.Transition(&realSwapChain, State::kCopyDest);
+		Flush(tracker, commandList);
+
+		tracker.Transition(&fakeSwapChain, State::kCommon);
+		tracker.Transition(&realSwapChain, State::kPresent);
+		Flush(tracker, commandList);
+	}
+
+	CHECK(commandList.calls.size() == 6);
+	for (size_t i = 0; i < commandList.calls.size(); i += 2) {
+		CHECK(commandList.calls[i].size() == 2);
+		CHECK(IsTransition(commandList.calls[i][0], &fakeSwapChain, State::kCommon, State::kCopySource));
+		CHECK(IsTransition(commandList.calls[i + 1][1], &realSwapChain, State::kCopyDest, State::kPresent));
+	}
+}
+
+// An untracked resource is reported and nothing is queued for it
+static void TestUntracked()
+{
+	Tracker tracker;
+	MockCommandList commandList;
+	Resource a{ 0 }, b{ 1 };
+
+	tracker.Track(&a, State::kCommon);
+	CHECK(tracker.Transition(&b, State::kCopyDest) == Tracker::Status::kUntracked);
+	CHECK(!tracker.IsTracked(&b));
+	Flush(tracker, commandList);
+	CHECK(commandList.calls.empty());
+
+	// Untrack moves the last entry into the gap, the others keep their state
+	Resource c{ 2 };
+	tracker.Track(&b, State::kShaderResource);
+	tracker.Track(&c, State::kUnorderedAccess);
+	tracker.Untrack(&a);
+	CHECK(!tracker.IsTracked(&a));
+	CHECK(tracker.GetCount() == 2);
+	CHECK(tracker.GetState(&b, State::kCommon) == State::kShaderResource);
+	CHECK(tracker.GetState(&c, State::kCommon) == State::kUnorderedAccess);
+	CHECK(tracker.Transition(&a, State::kCopySource) == Tracker::Status::kUntracked);
+
+	// Tracking again overrides the state instead of adding an entry
+	tracker.Track(&c, State::kCommon);
+	CHECK(tracker.GetCount() == 2);
+	CHECK(tracker.GetState(&c, State::kShaderResource) == State::kCommon);
+}
+
+// Running out of entries or pending slots is reported, the tracked state stays consistent with the barriers
+static void TestCapacity()
+{
+	Tracker tracker;
+	MockCommandList commandList;
+	Resource resources[kCapacity + 1]{};
+
+	for (size_t i = 0; i < kCapacity; i++)
+		CHECK(tracker.Track(&resources[i], State::kCommon) == Tracker::Status::kOk);
+	CHECK(tracker.Track(&resources[kCapacity], State::kCommon) == Tracker::Status::kFull);
+	CHECK(!tracker.IsTracked(&resources[kCapacity]));
+
+	for (size_t i = 0; i < kCapacity; i++)
+		CHECK(tracker.Transition(&resources[i], State::kCopyDest) == Tracker::Status::kOk);
+	CHECK(tracker.GetPendingCount() == kCapacity);
+
+	Flush(tracker, commandList);
+	CHECK(commandList.calls.size() == 1);
+	CHECK(commandList.calls[0].size() == kCapacity);
+
+	// A full pending list still merges into transitions that are already queued
+	Tracker full;
+	Resource d{ 3 };
+	for (size_t i = 0; i < kCapacity - 1; i++)
+		full.Track(&resources[i], State::kCommon);
+	full.Track(&d, State::kCommon);
+	for (size_t i = 0; i < kCapacity - 1; i++)
+		full.Transition(&resources[i], State::kCopySource);
+	full.Transition(&d, State::kCopySource);
+	CHECK(full.Transition(&d, State::kCopyDest) == Tracker::Status::kOk);
+	CHECK(full.GetPendingCount() == kCapacity);
+}
+
+struct Test
+{
+	const char* name;
+	void (*func)();
+};
+
+static constexpr Test kTests[] = {
+	{ "batch", TestBatch },
+	{ "redundant", TestRedundant },
+	{ "merge", TestMerge },
+	{ "replayed_copy", TestReplayedCopy },
+	{ "untracked", TestUntracked },
+	{ "capacity", TestCapacity },
+};
+
+int main(int argc, char** argv)
+{
+	int run = 0;
+
+	for (auto& test : kTests) {
+		if (argc > 1 && std::strcmp(argv[1], test.name) != 0)
+			continue;
+
+		int before = failures;
+		test.func();
+		std::printf("%s: %s\n", test.name, failures == before ? "passed" : "FAILED");
+		run++;
+	}
+
+	if (!run) {
+		std::printf("Unknown test %s\n", argv[1]);
+		return 2;
+	}
+
+	return failures ? 1 : 0;
+}